@@ -2,12 +2,24 @@
 #define ZTD_FILEDAT_HPP
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <map>
+#include <memory_resource>
+#include <unordered_map>
+#include <unordered_set>
 #include <iostream>
 #include <fstream>
 #include <exception>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <algorithm>
 
+#include <cstdint>
 #include <cstring>
 
 
@@ -23,6 +35,145 @@ namespace ztd
   class filedat;
   class chunkdat;
   class format_error;
+  class zfd_view;
+
+  //! @brief Memory usage of chunk data
+  /*! Byte counts are estimates of heap usage, allocator overhead is not included
+  */
+  struct chunk_stats
+  {
+    //! @brief Number of string chunks
+    size_t strings=0;
+    //! @brief Number of map chunks
+    size_t maps=0;
+    //! @brief Number of list chunks
+    size_t lists=0;
+    //! @brief Number of chunks without type
+    size_t empty=0;
+    //! @brief Number of map or list chunks not parsed yet (lazy import)
+    size_t unparsed=0;
+
+    //! @brief Heap bytes of string values and keys
+    size_t string_bytes=0;
+    //! @brief Bytes of chunk objects, including their allocation header
+    size_t node_bytes=0;
+    //! @brief Bytes of map nodes and list storage
+    size_t container_bytes=0;
+    //! @brief Bytes of imported source data (filedat only)
+    size_t source_bytes=0;
+
+    //! @brief Total number of chunks
+    inline size_t chunks() const { return strings+maps+lists+empty+unparsed; }
+    //! @brief Total bytes
+    inline size_t total() const { return string_bytes+node_bytes+container_bytes+source_bytes; }
+
+    //! @brief Add counts of other stats
+    chunk_stats& operator+=(chunk_stats const& in);
+  };
+
+  //! @brief Allocation hook
+  /*!
+    @param size Size of the allocated or freed object
+    @param alloc @a True on allocation, @a False on free
+  */
+  typedef void (*chunk_alloc_hook)(size_t size, bool alloc);
+  //! @brief Set hook called on every allocation and free of a counting_resource
+  /*! Covers chunk objects, strings and containers of chunks using the default chunk resource,
+      or any resource wrapped in a counting_resource. nullptr to disable \n
+      Hook can be called from multiple threads at once
+      @see counting_resource
+  */
+  void set_chunk_alloc_hook(chunk_alloc_hook hook);
+
+  //! @brief Memory resource reporting its allocations to the chunk allocation hook
+  /*! Forwards allocations to an upstream resource. Wrap a resource in it to count chunk allocations made from it
+      @see set_chunk_alloc_hook
+  */
+  class counting_resource : public std::pmr::memory_resource
+  {
+  public:
+    //! @brief Constructor
+    explicit counting_resource(std::pmr::memory_resource* upstream=std::pmr::get_default_resource()) : m_upstream(upstream) { ; }
+
+    //! @brief Resource allocations are forwarded to
+    inline std::pmr::memory_resource* upstream() const { return m_upstream; }
+
+  protected:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override;
+
+  private:
+    std::pmr::memory_resource* m_upstream;
+  };
+
+  //! @brief Default memory resource of chunks
+  /*! Counting resource over the default resource at the time of the first call
+      @see counting_resource
+  */
+  std::pmr::memory_resource* chunk_default_resource();
+
+  //! @brief Validate UTF-8 data
+  /*! Rejects overlong encodings, surrogates and code points above U+10FFFF. ASCII runs are checked a word at a time
+      @return Position of the first invalid sequence, @a data size if valid
+  */
+  constexpr size_t utf8_validate(std::string_view data)
+  {
+    const size_t size = data.size();
+    size_t i=0;
+    while(i < size)
+    {
+      if(!std::is_constant_evaluated())
+      {
+        // ASCII fast path: 16 bytes at a time
+        uint64_t w[2];
+        while(i+16 <= size)
+        {
+          std::memcpy(w, data.data()+i, 16);
+          if( ((w[0] | w[1]) & 0x8080808080808080ULL) != 0 )
+            break;
+          i += 16;
+        }
+        if(i >= size)
+          break;
+      }
+      unsigned char c = data[i];
+      if(c < 0x80)
+      {
+        i++;
+        continue;
+      }
+      size_t n;
+      uint32_t cp, min;
+      if((c & 0xE0) == 0xC0)
+      {
+        n=1; cp=c & 0x1F; min=0x80;
+      }
+      else if((c & 0xF0) == 0xE0)
+      {
+        n=2; cp=c & 0x0F; min=0x800;
+      }
+      else if((c & 0xF8) == 0xF0)
+      {
+        n=3; cp=c & 0x07; min=0x10000;
+      }
+      else // continuation or invalid byte
+        return i;
+      if(size-i <= n) // truncated
+        return i;
+      for(size_t j=1 ; j<=n ; j++)
+      {
+        unsigned char cc = data[i+j];
+        if((cc & 0xC0) != 0x80)
+          return i;
+        cp = (cp << 6) | (cc & 0x3F);
+      }
+      if(cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF))
+        return i;
+      i += n+1;
+    }
+    return size;
+  }
 
   //! @brief Abstract data storing object
   /*! Used for inheritance and type classing.
@@ -42,6 +193,11 @@ namespace ztd
     chunk_abstract();
     virtual ~chunk_abstract();
 
+    static void* operator new(size_t size);
+    static void* operator new(size_t size, std::pmr::memory_resource* resource);
+    static void operator delete(void* p, size_t size);
+    static void operator delete(void* p, std::pmr::memory_resource* resource);
+
   protected:
     typeEnum m_type;
   };
@@ -55,9 +211,9 @@ namespace ztd
   {
   public:
     //! @brief String data
-    std::string val;
+    std::pmr::string val;
 
-    chunk_string();
+    chunk_string(std::pmr::memory_resource* resource=ztd::chunk_default_resource());
     virtual ~chunk_string();
   };
 
@@ -70,9 +226,9 @@ namespace ztd
   {
   public:
     //! @brief Mapped data
-    std::map<std::string, chunkdat*> values;
+    std::pmr::map<std::pmr::string, chunkdat*, std::less<>> values;
 
-    chunk_map();
+    chunk_map(std::pmr::memory_resource* resource=ztd::chunk_default_resource());
     virtual ~chunk_map();
 
   };
@@ -86,9 +242,33 @@ namespace ztd
   {
   public:
     //! @brief List data
-    std::vector<chunkdat*> list;
+    std::pmr::vector<chunkdat*> list;
+
+    //! @brief Index of list elements by value of a field
+    struct index
+    {
+      //! @brief Elements by field value
+      std::unordered_multimap<std::string, chunkdat*> values;
+      //! @brief Indexed field value of elements
+      std::unordered_map<chunkdat*, std::string> keys;
+      //! @brief Elements modified since last update
+      std::unordered_set<chunkdat*> dirty;
+      //! @brief Whole index has to be built
+      bool rebuild=true;
+    };
+    //! @brief Indexes by field name
+    std::map<std::string, index> indexes;
+
+    //! @brief Add element to indexes
+    void index_add(chunkdat* elem);
+    //! @brief Remove element from indexes
+    void index_remove(chunkdat* elem);
+    //! @brief Mark element as modified in indexes
+    void index_dirty(chunkdat* elem);
+    //! @brief Bring index up to date
+    void index_update(std::string const& field, index& idx);
 
-    chunk_list();
+    chunk_list(std::pmr::memory_resource* resource=ztd::chunk_default_resource());
     virtual ~chunk_list();
   };
 
@@ -102,29 +282,56 @@ namespace ztd
   public:
     //! @brief Constructor
     chunkdat();
+    //! @brief Constructor with memory resource
+    /*! Subchunks, containers and strings of the chunk are allocated from @a resource,
+        which has to outlive the chunk
+    */
+    explicit chunkdat(std::pmr::memory_resource* resource);
     //! @brief Constructor with initial value
     chunkdat(const char* in);
     //! @brief Constructor with initial value
-    chunkdat(std::string const& in, int offset=0, filedat* parent=nullptr);
+    /*! @see set(std::string const& in, int offset, filedat* parent, bool lazy)
+    */
+    chunkdat(std::string const& in, int offset=0, filedat* parent=nullptr, bool lazy=false);
     //! @brief Constructor with initial value
     chunkdat(const char* in, const int in_size,  int offset=0, filedat* parent=nullptr);
-    //! @brief Constructor with copy
+    //! @brief Constructor with copy. Uses the default memory resource
     chunkdat(chunkdat const& in);
+    //! @brief Constructor with copy into memory resource
+    chunkdat(chunkdat const& in, std::pmr::memory_resource* resource);
+    //! @brief Constructor with move. Uses the memory resource of input
+    chunkdat(chunkdat&& in);
     //dtor
     ~chunkdat();
 
+    static void* operator new(size_t size);
+    static void* operator new(size_t size, std::pmr::memory_resource* resource);
+    static void operator delete(void* p, size_t size);
+    static void operator delete(void* p, std::pmr::memory_resource* resource);
+
     //! @brief Clear contents
     void clear();
     //! @brief Type of the stored data
     chunk_abstract::typeEnum type() const;
     //! @brief get pointer to chunk_abstract
-    inline chunk_abstract* getp() const { return m_achunk; }
+    inline chunk_abstract* getp() const { if(m_lazy != nullptr) materialize(); return m_achunk; }
+    //! @brief Data is parsed. @a False for map and list subchunks of a lazy import until accessed
+    inline bool parsed() const { return m_lazy == nullptr; }
     //! @brief Size of list. -1 if not a list
     int listSize() const;
     //! @brief Get pointer to parent (debug)
     inline filedat* parent() const { return m_parent; }
     //! @brief Get data offset (debug)
     inline int offset() const { return m_offset; }
+    //! @brief Get pointer to the chunk containing this chunk. nullptr if top level
+    inline chunkdat* upper() const { return m_upper; }
+    //! @brief Memory resource of the chunk
+    inline std::pmr::memory_resource* resource() const { return m_resource; }
+
+    //! @brief Structural hash of the chunk
+    /*! Computed on first call and cached until the chunk or one of its subchunks is modified
+    */
+    size_t hash() const;
 
 
     //! @brief Set data
@@ -132,8 +339,15 @@ namespace ztd
     @param in String data
     @param offset Used for debugging
     @param data Used for debugging
+    @param lazy Map and list subchunks are only parsed when first accessed.
+      Format errors inside them are then thrown on access
+    */
+    void set(std::string const& in, int offset=0, filedat* parent=nullptr, bool lazy=false);
+    //! @brief Set origin of unparsed subchunks
+    /*! Reported by format errors thrown when lazy subchunks are parsed, along with their offset
+        @see format_error::offset()
     */
-    void set(std::string const& in, int offset=0, filedat* parent=nullptr);
+    void set_origin(std::string const& origin);
     //! @brief Set data
     /*!
     @param in C string data
@@ -144,6 +358,14 @@ namespace ztd
     inline void set(const char* in, const int in_size, int offset=0, filedat* parent=nullptr) { this->set(std::string(in, in_size), offset, parent);}
     //! @brief Copy chunk data
     void set(chunkdat const& in);
+    //! @brief Move chunk data. Input is left empty
+    /*! Data is copied if input uses a different memory resource
+    */
+    void set(chunkdat&& in);
+    //! @brief Copy compile-time parsed data
+    /*! @see zfd_literal
+    */
+    void set(zfd_view const& in);
 
     //! @brief Create a copy of the chunk
     inline chunkdat copy() { return chunkdat(*this); }
@@ -158,6 +380,32 @@ namespace ztd
     @return String value of the whole chunk data
     */
     std::string strval(unsigned int alignment=0, std::string const& aligner="\t") const;
+    //! @brief Write string value of data to stream
+    /*! Same output as strval(), without building the whole string
+    */
+    void write(std::ostream& stream, unsigned int alignment=0, std::string const& aligner="\t") const;
+
+    //! @brief Set data from JSON
+    /*! Objects become maps, arrays lists, and strings, numbers and booleans strings. null becomes an empty chunk \n
+    Throws format_error exception on invalid JSON or duplicate keys
+    @param in JSON data
+    @param offset Used for debugging
+    @param parent Used for debugging
+    */
+    void set_json(std::string const& in, int offset=0, filedat* parent=nullptr);
+    //! @brief Get JSON value of data
+    /*! @see write_json(std::ostream& stream, unsigned int alignment, std::string const& aligner) const
+    */
+    std::string json(unsigned int alignment=0, std::string const& aligner="\t") const;
+    //! @brief Write JSON value of data to stream
+    /*! Strings are written as JSON strings, empty chunks as null
+    @param alignment Number of initial aligners
+    @param aligner String to use for aligning sub-chunks. Empty to write on a single line
+    */
+    void write_json(std::ostream& stream, unsigned int alignment=0, std::string const& aligner="\t") const;
+
+    //! @brief Memory usage of the chunk and its subchunks
+    chunk_stats memory_usage() const;
     //! @brief alias for strval()
     inline std::string str(unsigned int alignment=0, std::string const& aligner="\t") const { return strval(alignment, aligner); }
 
@@ -202,6 +450,11 @@ namespace ztd
         @param overwrite In case of collisions or type mismatch, input overwrites current chunk
     */
     void merge(chunkdat const& chk, bool overwrite=false);
+    //! @brief Merge chk into current chunk, moving its subchunks instead of copying
+    /*! Input is left in an unspecified state. Subchunks are copied if input uses a different memory resource
+        @see merge(chunkdat const& chk, bool overwrite)
+    */
+    void merge(chunkdat&& chk, bool overwrite=false);
 
     //! @brief Erase key from map
     void erase(const std::string& key);
@@ -210,6 +463,28 @@ namespace ztd
     void erase(const unsigned int index);
 
     std::vector<ztd::chunkdat*> getlist();
+
+    //! @brief Index list elements by field
+    /*! Elements are maps, indexed by the string value of their @a field key. \n
+        The index is built immediately and kept up to date when elements are added, erased or modified,
+        modified elements are reindexed on next lookup. \n
+        Indexes are not copied, and are rebuilt when the list chunk is replaced by another list \n
+        Throws format_error exception if chunk isn't a list
+    */
+    void build_index(std::string const& field);
+    //! @brief Remove index of list elements by field
+    void drop_index(std::string const& field);
+    //! @brief Find list element by field value
+    /*! Uses index of @a field if present, otherwise scans the list. \n
+        When indexed and several elements match, any of them may be returned \n
+        Throws format_error exception if chunk isn't a list
+        @return First element of which @a field has value @a value, nullptr if none
+    */
+    chunkdat* find_by(std::string const& field, std::string const& value) const;
+    //! @brief Find all list elements by field value
+    /*! @see find_by(std::string const& field, std::string const& value) const
+    */
+    std::vector<chunkdat*> find_all_by(std::string const& field, std::string const& value) const;
     std::map<std::string, ztd::chunkdat*> getmap();
 
     //! @brief Create a copy of the chunk
@@ -252,6 +527,8 @@ namespace ztd
     inline chunkdat& operator[](const unsigned int a) const                             { return subChunkRef(a); }
     //! @brief Set chunk data and return *this. @see set(chunkdat const& in)
     inline chunkdat& operator=(chunkdat const& a)                                       { set(a); return *this; }
+    //! @brief Move chunk data and return *this. @see set(chunkdat&& in)
+    inline chunkdat& operator=(chunkdat&& a)                                            { set(std::move(a)); return *this; }
     //! @brief add() and return *this.            @see add(std::string const& name, chunkdat const& val)
     inline chunkdat& operator+=(std::pair<std::string, chunkdat> const& a)              { add(a.first, a.second); return *this; }
     //! @brief add() and return *this.            @see add(std::vector<std::pair<std::string, chunkdat>> const& vec)
@@ -275,13 +552,53 @@ namespace ztd
 
 
   protected:
+    //! @brief Mark cached hash of the chunk and its upper chunks as outdated
+    /*! Indexed upper lists are notified of the modification
+    */
+    void invalidate_hash();
+    //! @brief Set this as upper chunk of direct subchunks
+    void adopt_subchunks();
+    //! @brief Build indexes of @a fields if the chunk is a list
+    void restore_indexes(std::vector<std::string> const& fields);
+    //! @brief Parse data of lazy chunk
+    void materialize() const;
+    //! @brief Create subchunk of this chunk
+    /*! @param lazy Map and list data is stored unparsed
+    */
+    chunkdat* new_subchunk(std::string&& in, int offset, bool lazy);
+    //! @brief Parse JSON value starting at position @a i of @a in. @a i is set after the value
+    void parse_json(std::string const& in, size_t& i, int offset, unsigned int depth);
+
+    std::pmr::memory_resource* m_resource;
     filedat* m_parent;
     int m_offset;
 
-    chunk_abstract* m_achunk;
+    mutable chunk_abstract* m_achunk;
+    chunkdat* m_upper;
+    //! @brief Unparsed data of lazy chunk, allocated from the chunk memory resource
+    struct lazy_data
+    {
+      std::pmr::string data;
+      //! @brief Origin reported by format errors
+      std::pmr::string origin;
+
+      lazy_data(std::string_view in, std::pmr::memory_resource* resource) : data(in, resource), origin(resource) { }
+      lazy_data(lazy_data const& in, std::pmr::memory_resource* resource) : data(in.data, resource), origin(in.origin, resource) { }
+
+      static void* operator new(size_t size, std::pmr::memory_resource* resource);
+      static void operator delete(void* p);
+      static void operator delete(void* p, std::pmr::memory_resource* resource);
+    };
+    mutable lazy_data* m_lazy;
+
+    mutable size_t m_hash;
+    mutable bool m_hash_valid;
   };
 
-  inline bool operator==(const chunkdat& a, const char* b) { return a.strval() == b; }
+  //! @brief Compare with string value
+  bool operator==(const chunkdat& a, const char* b);
+  //! @brief Structural equality of chunks. Hashes are compared first
+  bool operator==(const chunkdat& a, const chunkdat& b);
 
   //! @brief add
   inline chunkdat operator+(const chunkdat& a, const std::pair<std::string, chunkdat>& b)               { chunkdat ret(a); ret += b; return ret; }
@@ -302,6 +619,97 @@ namespace ztd
   inline chunkdat merge(chunkdat a, chunkdat const& b, bool overwrite) { a.merge(b, overwrite); return a; }
 
 
+  //! @brief Single change of a chunk_patch
+  struct patch_entry
+  {
+    //! @brief Type of change
+    /*! Values: add , remove , change
+    */
+    enum opEnum { add, remove, change };
+
+    //! @brief Type of change
+    opEnum op;
+    //! @brief Keys leading to the changed chunk. Elements of lists are designated by their index
+    std::vector<std::string> path;
+    //! @brief New value. Empty on remove
+    chunkdat value;
+  };
+
+  //! @brief Difference between two chunks
+  /*! Generated with diff() and applied with apply_patch() \n
+      Can be converted from and to chunk data for storage or transfer
+  */
+  class chunk_patch
+  {
+  public:
+    //! @brief Constructor
+    chunk_patch();
+    //! @brief Constructor from chunk data. @see set(chunkdat const& in)
+    chunk_patch(chunkdat const& in);
+
+    //! @brief Changes, in order of application
+    std::vector<patch_entry> entries;
+
+    //! @brief No changes
+    inline bool empty() const { return entries.size() <= 0; }
+    //! @brief Number of changes
+    inline size_t size() const { return entries.size(); }
+
+    //! @brief Set from chunk data
+    /*! Throws format_error exception when input isn't a valid patch
+    */
+    void set(chunkdat const& in);
+    //! @brief Get chunk data of the patch
+    chunkdat chunk() const;
+    //! @brief Get string value of the patch
+    inline std::string strval(std::string const& aligner="\t") const { return chunk().strval(0, aligner); }
+  };
+
+  //! @brief Difference between two chunks
+  /*! Identical subchunks are skipped by hash comparison
+      @return Patch turning @a a into @a b
+  */
+  chunk_patch diff(chunkdat const& a, chunkdat const& b);
+
+  //! @brief Apply patch to chunk
+  /*! Throws format_error exception when the patch doesn't apply
+  */
+  void apply_patch(chunkdat& chk, chunk_patch const& patch);
+
+  //! @brief Index of line positions in text data
+  /*! Maps data offsets to line and column in logarithmic time
+  */
+  class line_index
+  {
+  public:
+    //! @brief Constructor
+    line_index();
+    //! @brief Constructor with data to index
+    line_index(const char* data, size_t size);
+    //! @brief Constructor with data to index
+    inline line_index(std::string const& data) : line_index(data.c_str(), data.size()) { }
+
+    //! @brief Index data
+    void set(const char* data, size_t size);
+
+    //! @brief Number of lines
+    inline unsigned int lines() const { return m_starts.size(); }
+    //! @brief Line and column of offset in data, starting at 1
+    std::pair<unsigned int, unsigned int> location(size_t offset) const;
+    //! @brief Offset of start of line
+    /*! @param line Line number, starting at 1
+    */
+    size_t line_start(unsigned int line) const;
+    //! @brief Offset of end of line, excluding newline
+    /*! @param line Line number, starting at 1
+    */
+    size_t line_end(unsigned int line) const;
+
+  private:
+    std::vector<size_t> m_starts;
+    size_t m_size;
+  };
+
   //! @brief File data object
   /*!
   Object for importing, reading, altering and writing of file data\n
@@ -309,6 +717,16 @@ namespace ztd
   class filedat
   {
   public:
+    //! @brief Compression of exported data
+    /*! Values: no_compression , gzip , zstd \n
+        gzip requires building with ZLIB=1, zstd with ZSTD=1
+    */
+    enum compressionEnum { no_compression, gzip, zstd };
+    //! @brief Format of imported and exported data
+    /*! Values: zfd , json
+    */
+    enum formatEnum { zfd, json };
+
     //! @brief Constructor
     filedat();
     //! @brief Constructor with initial file path
@@ -320,11 +738,37 @@ namespace ztd
     //! @brief Set file path
     inline void setFilePath(std::string const& in) { m_filePath=in; }
 
+    //! @brief Lazy import is enabled
+    inline bool lazy() const { return m_lazy; }
+    //! @brief Enable lazy import
+    /*! Map and list subchunks of imported data are only parsed when first accessed.
+        Format errors inside them are then thrown on access
+    */
+    inline void setLazy(bool in) { m_lazy=in; }
+
+    //! @brief Data format
+    inline formatEnum format() const { return m_format; }
+    //! @brief Set data format used by imports and exports
+    /*! @see chunkdat::set_json(std::string const& in, int offset, filedat* parent), chunkdat::write_json(std::ostream& stream, unsigned int alignment, std::string const& aligner) const \n
+        Lazy import doesn't apply to JSON
+    */
+    inline void setFormat(formatEnum in) { m_format=in; }
+
+    //! @brief Memory resource of the data
+    inline std::pmr::memory_resource* resource() const { return m_resource; }
+    //! @brief Set memory resource of the data
+    /*! Current data is moved to the resource, imports then allocate from it.
+        The resource has to outlive the data
+        @see chunkdat::chunkdat(std::pmr::memory_resource* resource)
+    */
+    void setResource(std::pmr::memory_resource* resource);
+
     //! @brief Test wether file can be read
     bool readTest() const;
 
     //! @brief Import file data
     /*!
+    gzip and zstd compressed files are detected and decompressed while reading \n
     Throws format_error exceptions if errors are encountered while reading
     @param path Will set this as file path if not empty
     */
@@ -339,12 +783,24 @@ namespace ztd
     Throws format_error exceptions if errors are encountered while reading
     */
     void import_string(const std::string& data);
+    //! @brief Import and merge multiple files
+    /*!
+    Files are read and parsed in parallel, then merged in order into the data. \n
+    Subchunks are moved into the data rather than copied, unless a memory resource is set: \n
+    files are then parsed with the default resource and copied, as the resource may not be thread-safe \n
+    Throws format_error exceptions if errors are encountered while reading, or if merging fails
+    @param paths Files to import, in merge order
+    @param overwrite Later files overwrite previous ones on collision. @see chunkdat::merge(chunkdat const& chk, bool overwrite)
+    @param threads Number of reading threads. 0 for number of CPU cores
+    */
+    void import_many(std::vector<std::string> const& paths, bool overwrite=false, unsigned int threads=0);
     //! @brief Export data to file
     /*!
     @param path Will set this as file path if not empty
     @param aligner String used to align subchunks
+    @param compression Compress data while writing
     */
-    bool export_file(std::string const& path="", std::string const& aligner="\t") const;
+    bool export_file(std::string const& path="", std::string const& aligner="\t", compressionEnum compression=no_compression) const;
 
     //! @brief Clear contents of data
     void clear();
@@ -356,6 +812,13 @@ namespace ztd
     std::string strval(std::string const& aligner="\t") const;
     //! @brief Alias for strval()
     inline std::string str(std::string const& aligner="\t") const { return this->strval(aligner); }
+    //! @brief Write string value of data to stream
+    void write(std::ostream& stream, std::string const& aligner="\t") const;
+
+    //! @brief Memory usage of the data
+    /*! Includes the imported data kept for debugging
+    */
+    chunk_stats stats() const;
 
     //! @brief Get reference to chunk data
     inline chunkdat& data() const { return *m_dataChunk; }
@@ -374,6 +837,15 @@ namespace ztd
     //! @brief Imported data as is. Used for debugging
     inline const char* im_c_data() const { return m_data.c_str(); }
 
+    //! @brief Line index of imported data
+    /*! Built on first call
+    */
+    line_index const& lines() const;
+    //! @brief Line and column of offset in imported data, starting at 1
+    /*! @see chunkdat::offset()
+    */
+    inline std::pair<unsigned int, unsigned int> location(int offset) const { return lines().location(offset); }
+
     //! @brief Reference to subchunk
     //! @see chunkdat::operator[](std::string const &a) const
     inline chunkdat& operator[](const std::string& index) const { return m_dataChunk->subChunkRef(index); }
@@ -386,7 +858,9 @@ namespace ztd
     inline filedat& operator=(chunkdat const& a)                                       { set_data(a); return *this; }
 
     //! @brief Is a read char
-    static bool isRead(char in);
+    /*! Printable ASCII and bytes of UTF-8 multibyte sequences
+    */
+    static constexpr bool isRead(char in) { return (unsigned char) in >= 33 && (unsigned char) in != 127; }
     static std::string removeComments(std::string str);
 
     inline operator chunkdat() const { return *m_dataChunk; }
@@ -400,6 +874,142 @@ namespace ztd
     std::string m_filePath;
     std::string m_data;
     chunkdat* m_dataChunk;
+
+    mutable line_index m_lines;
+    mutable bool m_lines_valid;
+    bool m_lazy;
+    formatEnum m_format;
+    std::pmr::memory_resource* m_resource;
+  };
+
+  //! @brief Read-only chunk data shared between threads
+  typedef std::shared_ptr<const chunkdat> chunk_snapshot;
+
+  //! @brief Publisher of chunk snapshots
+  /*!
+    A writer builds new data and publishes it with publish(), readers get the latest published snapshot. \n
+    Snapshots are never modified once published: old snapshots are freed when their last reader releases them. \n
+    Use one chunk_reader per reading thread for wait-free access to the latest snapshot
+  */
+  class chunk_publisher
+  {
+  public:
+    //! @brief Constructor
+    chunk_publisher();
+    //! @brief Constructor with initial data
+    chunk_publisher(chunkdat const& in);
+
+    //! @brief Publish a copy of chunk data
+    void publish(chunkdat const& in);
+    //! @brief Publish a copy of file data
+    inline void publish(filedat const& in) { publish(in.data()); }
+    //! @brief Publish chunk data
+    /*! Data must not be modified once published
+    */
+    void publish(std::shared_ptr<chunkdat> in);
+
+    //! @brief Get latest snapshot
+    /*! Locks the publisher, prefer chunk_reader for frequent reads
+    */
+    chunk_snapshot acquire() const;
+    //! @brief Version of the latest snapshot. Increased on every publish
+    inline uint64_t version() const { return m_version.load(std::memory_order_acquire); }
+
+  private:
+    chunk_snapshot m_snapshot;
+    std::atomic<uint64_t> m_version;
+    mutable std::mutex m_mtx;
+  };
+
+  //! @brief Per-thread reader of a chunk_publisher
+  /*!
+    Keeps the last acquired snapshot and only reloads it from the publisher when a new version is published. \n
+    Reading an unchanged snapshot doesn't write any shared memory and scales with the number of threads. \n
+    A single reader must not be used by several threads at once
+  */
+  class chunk_reader
+  {
+  public:
+    //! @brief Constructor
+    chunk_reader(chunk_publisher const& pub);
+
+    //! @brief Get latest snapshot
+    /*! @return Reference to the data, valid until the next call to get() or acquire()
+    */
+    inline chunkdat const& get() { return *acquire(); }
+    //! @brief Get latest snapshot
+    chunk_snapshot const& acquire();
+    //! @brief Drop held snapshot
+    void release();
+
+    //! @brief Read-only reference to subchunk of latest snapshot
+    inline chunkdat const& operator[](std::string const& a) { return get()[a]; }
+    //! @brief Read-only reference to subchunk of latest snapshot
+    inline chunkdat const& operator[](const unsigned int a) { return get()[a]; }
+
+  private:
+    chunk_publisher const* m_publisher;
+    chunk_snapshot m_snapshot;
+    uint64_t m_version;
+  };
+
+  //! @brief Background file writer
+  /*!
+    Exports data to files on a background thread. \n
+    Files are written to a temporary file, synced to disk, then renamed over the destination:
+    a crash never leaves a partially written file. \n
+    Exports of the same file that are still pending are replaced by the latest one. \n
+    Pending exports are written before destruction
+  */
+  class file_writer
+  {
+  public:
+    //! @brief Constructor. Starts the writing thread
+    file_writer();
+    virtual ~file_writer();
+
+    //! @brief Export data to file in background
+    /*! Data isn't copied, it must not be modified once given
+        @param data Data to write
+        @param path Destination file
+        @param aligner String used to align subchunks
+        @param compression Compress data while writing
+        @param format Format of written data
+    */
+    void export_async(chunk_snapshot data, std::string const& path, std::string const& aligner="\t", filedat::compressionEnum compression=filedat::no_compression, filedat::formatEnum format=filedat::zfd);
+    //! @brief Export copy of chunk data to file in background
+    /*! @see export_async(chunk_snapshot data, std::string const& path, std::string const& aligner, filedat::compressionEnum compression, filedat::formatEnum format)
+    */
+    void export_async(chunkdat const& data, std::string const& path, std::string const& aligner="\t", filedat::compressionEnum compression=filedat::no_compression, filedat::formatEnum format=filedat::zfd);
+    //! @brief Export copy of file data in background, in the format of the file
+    /*! @param path Use file path of @a file if empty
+        @see export_async(chunk_snapshot data, std::string const& path, std::string const& aligner, filedat::compressionEnum compression, filedat::formatEnum format)
+    */
+    void export_async(filedat const& file, std::string const& path="", std::string const& aligner="\t", filedat::compressionEnum compression=filedat::no_compression);
+
+    //! @brief Wait until all pending exports are written
+    void flush();
+    //! @brief Number of failed exports
+    inline unsigned int errors() const { return m_errors; }
+
+  private:
+    struct job
+    {
+      chunk_snapshot data;
+      std::string aligner;
+      filedat::compressionEnum compression;
+      filedat::formatEnum format;
+    };
+
+    static void run(file_writer* w);
+
+    std::thread m_thread;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::map<std::string, job> m_pending;
+    bool m_writing;
+    bool m_stop;
+    std::atomic<unsigned int> m_errors;
   };
 
   //! @brief Data format exception
@@ -410,7 +1020,7 @@ namespace ztd
   {
   public:
     //! @brief Conctructor
-    inline format_error(const std::string& what, const std::string& origin, const std::string& data, int where)  { desc=what; index=where; filename=origin; sdat=data; }
+    inline format_error(const std::string& what, const std::string& origin, const std::string& data, int where, int offset=0)  { desc=what; index=where; filename=origin; sdat=data; base=offset; }
 
     //! @brief Error message
     inline const char * what () const throw () {return desc.c_str();}
@@ -420,18 +1030,441 @@ namespace ztd
     inline const char * data() const throw () {return sdat.c_str();}
     //! @brief Where the error is located in the data
     inline const int where () const throw () {return index;}
+    //! @brief Position of the data in its origin
+    /*! Non-zero when the data is part of an imported file, e.g. unparsed data of lazy chunks
+    */
+    inline int offset () const throw () {return base;}
   private:
     std::string desc;
     int index;
+    int base;
     std::string filename;
     std::string sdat;
   };
 
-  inline std::ostream& operator<<(std::ostream& stream, chunkdat const& a)  { return stream << a.strval(); }
-  inline std::ostream& operator<<(std::ostream& stream, filedat const& a)   { return stream << a.strval(); }
+  //! @brief String literal usable as template parameter
+  template <size_t N>
+  struct zfd_string
+  {
+    char data[N];
+
+    constexpr zfd_string(const char (&in)[N]) { for(size_t i=0 ; i<N ; i++) data[i]=in[i]; }
+    constexpr std::string_view view() const { return std::string_view(data, N-1); }
+  };
+
+  //! @brief Node of a compile-time parsed tree
+  /*! Strings are stored as offset and size in the character data of the tree
+  */
+  struct zfd_node
+  {
+    chunk_abstract::typeEnum type;
+    //! @brief Key in upper map
+    size_t key, key_size;
+    //! @brief String value
+    size_t value, value_size;
+    //! @brief Subnodes of map or list, as position of the first and count. Map subnodes are sorted by key
+    size_t first, size;
+  };
+
+  //! @brief Read-only view on compile-time parsed data
+  /*! Usable in constant expressions. @see zfd_literal
+  */
+  class zfd_view
+  {
+  public:
+    constexpr zfd_view(const zfd_node* nodes, const char* chars, size_t index=0) : m_nodes(nodes), m_chars(chars), m_index(index) { }
+
+    //! @brief Type of the data
+    constexpr chunk_abstract::typeEnum type() const { return node().type; }
+    //! @brief Key in upper map. Empty if not in a map
+    constexpr std::string_view key() const { return std::string_view(m_chars+node().key, node().key_size); }
+    //! @brief Value of string data. Empty if not a string
+    constexpr std::string_view str() const { return std::string_view(m_chars+node().value, node().value_size); }
+    //! @brief Number of subchunks of map or list
+    constexpr size_t size() const { return node().size; }
+    //! @brief Subchunk by position. Maps are ordered by key
+    constexpr zfd_view at(size_t i) const { return zfd_view(m_nodes, m_chars, node().first+i); }
+    //! @brief Map contains key
+    constexpr bool contains(std::string_view key) const { return find(key) < size(); }
+
+    //! @brief Subchunk of map
+    /*! Throws format_error exception when operation fails
+    */
+    constexpr zfd_view operator[](std::string_view key) const
+    {
+      if(type() != chunk_abstract::map)
+        throw format_error("zfd_view isn't a map", "", "", -1);
+      size_t i = find(key);
+      if(i >= size())
+        throw format_error("zfd_view doesn't contain '" + std::string(key) + "'", "", "", -1);
+      return at(i);
+    }
+    //! @brief Subchunk of list
+    /*! Throws format_error exception when operation fails
+    */
+    constexpr zfd_view operator[](size_t i) const
+    {
+      if(type() != chunk_abstract::list)
+        throw format_error("zfd_view isn't a list", "", "", -1);
+      if(i >= size())
+        throw format_error("zfd_view list size is "+std::to_string(size()), "", "", -1);
+      return at(i);
+    }
+
+    //! @brief Create chunk from the data
+    inline chunkdat chunk(std::pmr::memory_resource* resource=ztd::chunk_default_resource()) const { chunkdat ret(resource); ret.set(*this); return ret; }
+    //! @brief alias for chunk()
+    inline operator chunkdat() const { return chunk(); }
+
+  private:
+    constexpr zfd_node const& node() const { return m_nodes[m_index]; }
+    // position of key in map, size() if none
+    constexpr size_t find(std::string_view key) const
+    {
+      if(type() != chunk_abstract::map)
+        return 0;
+      size_t a=0, b=size();
+      while(a < b) // binary search
+      {
+        size_t m = (a+b)/2;
+        if(at(m).key() < key)
+          a = m+1;
+        else
+          b = m;
+      }
+      if(a < size() && at(a).key() == key)
+        return a;
+      return size();
+    }
+
+    const zfd_node* m_nodes;
+    const char* m_chars;
+    size_t m_index;
+  };
+
+  //! @brief Compile-time parsed data, stored in read-only data
+  template <size_t Nodes, size_t Chars>
+  struct zfd_static
+  {
+    zfd_node nodes[Nodes];
+    char chars[Chars+1];
+
+    //! @brief View on the data
+    constexpr zfd_view view() const { return zfd_view(nodes, chars); }
+    constexpr operator zfd_view() const { return view(); }
+
+    //! @brief Type of the data
+    constexpr chunk_abstract::typeEnum type() const { return view().type(); }
+    //! @brief Value of string data
+    constexpr std::string_view str() const { return view().str(); }
+    //! @brief Number of subchunks of map or list
+    constexpr size_t size() const { return view().size(); }
+    //! @brief Subchunk of map. @see zfd_view::operator[](std::string_view key) const
+    constexpr zfd_view operator[](std::string_view key) const { return view()[key]; }
+    //! @brief Subchunk of list. @see zfd_view::operator[](size_t i) const
+    constexpr zfd_view operator[](size_t i) const { return view()[i]; }
+
+    //! @brief Create chunk from the data
+    inline chunkdat chunk(std::pmr::memory_resource* resource=ztd::chunk_default_resource()) const { return view().chunk(resource); }
+    //! @brief alias for chunk()
+    inline operator chunkdat() const { return chunk(); }
+  };
+
+  //! @brief Compile-time ZFD parsing. <b> Not for external use </b>
+  /*! Same rules as chunkdat::set(std::string const& in, int offset, filedat* parent, bool lazy), on data without comments
+  */
+  namespace _zfd
+  {
+    //! @brief Reports format errors. Not constexpr: an invalid literal fails the build at this call
+    void parse_error(const char* message);
+
+    // std::string isn't reliable in constant evaluation on all compilers
+    typedef std::vector<char> text;
+
+    constexpr std::string_view view(text const& str) { return std::string_view(str.data(), str.size()); }
+
+    constexpr bool is_read(char in) { return filedat::isRead(in); }
+
+    constexpr char at(text const& str, size_t i) { return i < str.size() ? str[i] : 0; }
+
+    constexpr size_t skip(text const& str)
+    {
+      size_t i=0;
+      while(i < str.size() && !is_read(str[i]))
+        i++;
+      return i;
+    }
+
+    constexpr size_t quote_end(text const& str, size_t start, char quote)
+    {
+      for(size_t i=start ; i<str.size() ; i++)
+      {
+        if(str[i] == '\\') // escaped char
+          i++;
+        else if(str[i] == quote)
+          return i;
+      }
+      return std::string::npos;
+    }
+
+    constexpr size_t unescape(text& out, text const& str, size_t start, char quote)
+    {
+      size_t end = quote_end(str, start, quote);
+      for(size_t i=start ; i<end && i<str.size() ; i++)
+      {
+        if(str[i] == '\\' && i+1 < end && (str[i+1] == quote || str[i+1] == '\\')) // escaped char: skip backslash
+          i++;
+        out.push_back(str[i]);
+      }
+      return end;
+    }
+
+    constexpr text remove_comments(text str)
+    {
+      size_t i=0;
+      while(i < str.size())
+      {
+        if(str[i] == '\\')
+          i++;
+        else if(str[i] == '"' || str[i] == '\'')
+        {
+          size_t e = quote_end(str, i+1, str[i]);
+          if(e == std::string::npos)
+            parse_error("Quote doesn't close");
+          i = e+1;
+        }
+        else if(str[i] == '#' || (str[i] == '/' && at(str, i+1) == '/'))
+          str.erase(str.begin()+i, std::find(str.begin()+i, str.end(), '\n'));
+        i++;
+      }
+      return str;
+    }
+
+    struct strval
+    {
+      text val;
+      text rest;
+      bool delim_found;
+    };
+
+    constexpr strval getstrval(text const& str, char delim=0, char altdelim=0)
+    {
+      strval ret{text(), text(), false};
+      size_t i = skip(str);
+      if(i >= str.size())
+        return ret;
+      while(i < str.size())
+      {
+        if(str[i] == '"' || str[i] == '\'')
+        {
+          size_t e = unescape(ret.val, str, i+1, str[i]);
+          if(e == std::string::npos)
+            parse_error("Quote doesn't close");
+          i = e+1;
+        }
+        if(at(str, i) == '{' || at(str, i) == '[') // copy map or list as is
+        {
+          char open = str[i], close = open == '{' ? '}' : ']';
+          size_t counter=0;
+          ret.val.push_back(str[i++]);
+          while(i < str.size() && !(counter == 0 && str[i] == close))
+          {
+            if(str[i] == close)
+              counter--;
+            else if(str[i] == open)
+              counter++;
+            else if(str[i] == '"' || str[i] == '\'')
+            {
+              size_t e = quote_end(str, i+1, str[i]);
+              if(e == std::string::npos)
+                parse_error("Quote doesn't close");
+              ret.val.insert(ret.val.end(), str.begin()+i, str.begin()+e);
+              i = e;
+            }
+            ret.val.push_back(str[i++]);
+          }
+          if(i >= str.size())
+            parse_error("Brace does not close");
+          ret.val.push_back(str[i++]);
+        }
+        else if(!is_read(at(str, i)))
+        {
+          if(delim == 0)
+            break;
+          size_t j=i;
+          while(i < str.size() && !is_read(str[i]) && !(str[i] == delim || str[i] == altdelim))
+            i++;
+          if(at(str, i) == delim || at(str, i) == altdelim)
+          {
+            i++;
+            break;
+          }
+          ret.val.insert(ret.val.end(), str.begin()+j, str.begin()+i);
+        }
+        else
+        {
+          if(str[i] == delim || str[i] == altdelim)
+          {
+            i++;
+            break;
+          }
+          ret.val.push_back(str[i++]);
+        }
+      }
+      if(i < str.size())
+      {
+        ret.rest = text(str.begin()+i, str.end());
+        ret.delim_found = true;
+      }
+      else
+      {
+        while(ret.val.size() > 0 && !is_read(ret.val.back()))
+          ret.val.pop_back();
+      }
+      return ret;
+    }
+
+    struct builder
+    {
+      std::vector<zfd_node> nodes;
+      text chars;
+
+      constexpr void set_string(size_t index, text const& val)
+      {
+        nodes[index].type = chunk_abstract::string;
+        nodes[index].value = chars.size();
+        nodes[index].value_size = val.size();
+        chars.insert(chars.end(), val.begin(), val.end());
+      }
+
+      constexpr void set_children(size_t index, chunk_abstract::typeEnum type, std::vector<std::pair<text, text>>& children)
+      {
+        if(type == chunk_abstract::map)
+        {
+          std::sort(children.begin(), children.end(), [](auto const& a, auto const& b) { return view(a.first) < view(b.first); });
+          for(size_t i=1 ; i<children.size() ; i++)
+          {
+            if(children[i].first == children[i-1].first)
+              parse_error("Key already present");
+          }
+        }
+        size_t first = nodes.size();
+        nodes.resize(first + children.size(), zfd_node{chunk_abstract::none, 0, 0, 0, 0, 0, 0});
+        nodes[index].type = type;
+        nodes[index].first = first;
+        nodes[index].size = children.size();
+        for(size_t i=0 ; i<children.size() ; i++)
+        {
+          nodes[first+i].key = chars.size();
+          nodes[first+i].key_size = children[i].first.size();
+          chars.insert(chars.end(), children[i].first.begin(), children[i].first.end());
+          parse(children[i].second, first+i);
+        }
+      }
+
+      constexpr void parse(text const& in, size_t index)
+      {
+        // strings are taken as is: values are already unescaped
+        size_t first = skip(in);
+        if(first >= in.size())
+          return set_string(index, text());
+        if(in[first] != '{' && in[first] != '[')
+          return set_string(index, in);
+        strval top = getstrval(in);
+        text& str = top.val;
+        if(skip(top.rest) < top.rest.size())
+          parse_error("Unexpected char");
+        bool is_map = str[0] == '{';
+        str.erase(str.begin());
+        str.pop_back();
+        std::vector<std::pair<text, text>> children;
+        if(skip(str) < str.size())
+        {
+          do
+          {
+            if(is_map)
+            {
+              if(at(str, skip(str)) == '=')
+                parse_error("Value has no key");
+              strval key = getstrval(str, '=');
+              if(key.val.size() > 0 && key.val[0] == ';') // ignore ; : new value
+              {
+                str = text(key.val.begin()+1, key.val.end());
+                str.insert(str.end(), key.rest.begin(), key.rest.end());
+                continue;
+              }
+              if(key.val.empty() && skip(key.rest) < key.rest.size())
+                parse_error("Value has no key");
+              if(!key.val.empty() && !key.delim_found)
+                parse_error("Key has no value");
+              strval value = getstrval(key.rest, ';', '\n');
+              str = std::move(value.rest);
+              if(!key.val.empty())
+                children.push_back(std::make_pair(std::move(key.val), std::move(value.val)));
+            }
+            else
+            {
+              strval value = getstrval(str, ',', ';');
+              str = std::move(value.rest);
+              children.push_back(std::make_pair(text(), std::move(value.val)));
+            }
+          }
+          while(!str.empty());
+        }
+        set_children(index, is_map ? chunk_abstract::map : chunk_abstract::list, children);
+      }
+
+      constexpr builder(std::string_view in) : nodes(1, zfd_node{chunk_abstract::none, 0, 0, 0, 0, 0, 0})
+      {
+        if(utf8_validate(in) != in.size())
+          parse_error("Invalid UTF-8");
+        parse(remove_comments(text(in.begin(), in.end())), 0);
+      }
+    };
+
+    template <zfd_string S>
+    consteval std::pair<size_t, size_t> sizes()
+    {
+      builder b(S.view());
+      return std::make_pair(b.nodes.size(), b.chars.size());
+    }
+
+    template <zfd_string S>
+    consteval auto make()
+    {
+      constexpr std::pair<size_t, size_t> n = sizes<S>();
+      builder b(S.view());
+      zfd_static<n.first, n.second> ret{};
+      for(size_t i=0 ; i<n.first ; i++)
+        ret.nodes[i] = b.nodes[i];
+      for(size_t i=0 ; i<n.second ; i++)
+        ret.chars[i] = b.chars[i];
+      return ret;
+    }
+  }
+
+  //! @brief ZFD data parsed at compile time
+  /*! Parsed like an imported file, comments included. Format errors fail the build \n
+      The tree is immutable and stored in read-only data. It can be read directly, or converted to chunkdat
+      @see zfd_view, zfd_static
+  */
+  template <zfd_string S>
+  inline constexpr auto zfd_literal = _zfd::make<S>();
+
+  namespace literals
+  {
+    //! @brief ZFD data parsed at compile time. @see zfd_literal
+    template <zfd_string S>
+    constexpr auto const& operator""_zfd() { return zfd_literal<S>; }
+  }
+
+  inline std::ostream& operator<<(std::ostream& stream, chunkdat const& a)  { a.write(stream); return stream; }
+  inline std::ostream& operator<<(std::ostream& stream, filedat const& a)   { a.write(stream); return stream; }
 
 
   void printErrorIndex(const char* in, const int index, const std::string& message, const std::string& origin);
+  //! @brief Print error using a prebuilt line index of the data. @see printErrorIndex(const char* in, const int index, const std::string& message, const std::string& origin)
+  void printErrorIndex(line_index const& lines, const char* in, const int index, const std::string& message, const std::string& origin);
   //! @brief Print exception to console
   /*!
     If origin is known, displays location and discriminating line\n
@@ -442,4 +1475,10 @@ namespace ztd
 }
 
 
+//! @brief Hash of chunk. @see ztd::chunkdat::hash()
+template<> struct std::hash<ztd::chunkdat>
+{
+  inline size_t operator()(ztd::chunkdat const& a) const { return a.hash(); }
+};
+
 #endif //ZTD_FILEDAT_HPP
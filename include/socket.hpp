@@ -5,9 +5,18 @@
 #include <thread>
 #include <vector>
 #include <iostream>
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+#include <span>
+#include <algorithm>
+#include <chrono>
+#include <deque>
 
 // #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/uio.h>
 
 #include <mutex>              // std::mutex, std::unique_lock
 #include <condition_variable> // std::condition_variable
@@ -19,11 +28,217 @@
 
 namespace ztd
 {
+  class event_loop;
+  class io_engine;
+
+  //! @brief Lock-free single producer, single consumer byte ring
+  /*! One thread writes with write_span()/commit() or write(), another reads with peek()/consume() or read(). \n
+      Spans are accessed in place: a span ends at the wrap point of the ring, the remainder is available on the next call
+  */
+  class spsc_ring
+  {
+  public:
+    //! @brief Constructor
+    /*! @param capacity Size in bytes, rounded up to a power of 2
+    */
+    spsc_ring(size_t capacity=0);
+
+    //! @brief Reallocate and empty the ring. Not thread-safe
+    void reset(size_t capacity);
+    //! @brief Total size in bytes
+    inline size_t capacity() const { return m_capacity; }
+    //! @brief Number of readable bytes
+    inline size_t size() const { return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire); }
+    //! @brief No readable bytes
+    inline bool empty() const { return size() == 0; }
+
+    //! @brief Contiguous free space (producer)
+    std::span<uint8_t> write_span();
+    //! @brief Publish @a n bytes written to write_span() (producer)
+    void commit(size_t n);
+    //! @brief Copy data in (producer)
+    /*! @return Number of bytes written
+    */
+    size_t write(uint8_t const* data, size_t size);
+
+    //! @brief Contiguous readable bytes (consumer)
+    std::span<const uint8_t> peek() const;
+    //! @brief Release @a n bytes read from peek() (consumer)
+    void consume(size_t n);
+    //! @brief Copy data out (consumer)
+    /*! @return Number of bytes read
+    */
+    size_t read(uint8_t* data, size_t size);
+
+  private:
+    std::unique_ptr<uint8_t[]> m_data;
+    size_t m_capacity;
+    // consumer and producer positions, on separate cache lines
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+  };
+
+  class buffer_pool;
+
+  //! @brief Splits a byte stream into messages
+  /*! Received data is reassembled in a reusable buffer and complete messages are delivered as views into it. \n
+      Messages are either prefixed by their length as an unsigned LEB128 varint, or terminated by a delimiter byte. \n
+      Messages larger than the maximum size put the framer in error state, see error()
+  */
+  class message_framer
+  {
+  public:
+    //! @brief Framing modes
+    enum modeEnum { varint, delimiter };
+
+    //! @brief Constructor
+    /*! @param mode Framing mode
+        @param maxSize Maximum size of a message, not counting its framing
+        @param delim Delimiter byte in delimiter mode
+    */
+    message_framer(modeEnum mode=varint, size_t maxSize=1048576, uint8_t delim='\n');
+
+    //! @brief Framing mode
+    inline modeEnum mode() const { return m_mode; }
+    //! @brief Maximum size of a message
+    inline size_t max_size() const { return m_maxSize; }
+    //! @brief Delimiter byte
+    inline uint8_t delim() const { return m_delim; }
+    //! @brief A message exceeded the maximum size or had an invalid length. No more messages are delivered until reset()
+    inline bool error() const { return m_error; }
+    //! @brief Number of buffered bytes not yet delivered
+    inline size_t buffered() const { return m_end - m_start; }
+
+    //! @brief Add received data
+    void feed(uint8_t const* data, size_t size);
+    //! @brief Free space to receive data into directly
+    /*! @param size Minimum size of the space
+    */
+    std::span<uint8_t> prepare(size_t size);
+    //! @brief Add @a n bytes received into prepare()
+    void commit(size_t n);
+
+    //! @brief Get the next complete message
+    /*! @param message Set to the message, without its framing. Valid until the next call to a non-const method
+        @return @a True if a message was complete, @a False otherwise
+    */
+    bool next(std::span<const uint8_t>& message);
+
+    //! @brief Drop buffered data and clear error state
+    void reset();
+
+    //! @brief Write the varint encoding of @a size
+    /*! @param out Buffer of at least 10 bytes
+        @return Number of bytes written
+    */
+    static size_t encode_varint(uint64_t size, uint8_t* out);
+
+  private:
+    modeEnum m_mode;
+    size_t m_maxSize;
+    uint8_t m_delim;
+    bool m_error;
+
+    std::vector<uint8_t> m_buffer;
+    // undelivered data is [m_start, m_end), delimiter search resumes at m_scan
+    size_t m_start;
+    size_t m_end;
+    size_t m_scan;
+  };
+
+  //! @brief Handle to a buffer of a buffer_pool
+  /*! Move-only. The buffer returns to its pool once its last handle is destroyed, see share()
+  */
+  class pool_buffer
+  {
+  public:
+    pool_buffer() { m_block=nullptr; }
+    pool_buffer(pool_buffer&& other) noexcept;
+    pool_buffer& operator=(pool_buffer&& other) noexcept;
+    pool_buffer(pool_buffer const&) = delete;
+    pool_buffer& operator=(pool_buffer const&) = delete;
+    ~pool_buffer();
+
+    //! @brief Handle holds a buffer
+    inline explicit operator bool() const { return m_block != nullptr; }
+    //! @brief Buffer data
+    inline uint8_t* data() const { return m_block->data; }
+    //! @brief Size of the data in the buffer
+    inline size_t size() const { return m_block->size; }
+    //! @brief Size of the buffer
+    size_t capacity() const;
+    //! @brief Set size of the data in the buffer, up to capacity()
+    inline void resize(size_t size) { m_block->size = std::min(size, capacity()); }
+    //! @brief Data in the buffer
+    inline std::span<uint8_t> span() const { return std::span<uint8_t>(m_block->data, m_block->size); }
+
+    //! @brief Another handle to the same buffer
+    pool_buffer share() const;
+    //! @brief Release the buffer
+    void reset();
+
+  private:
+    friend class buffer_pool;
+    friend class socket_abstract;
+
+    struct block {
+      std::atomic<uint32_t> refs;
+      uint32_t size;
+      uint8_t* data;
+      buffer_pool* pool;
+      // free list or receive queue
+      block* next;
+    };
+
+    pool_buffer(block* b) { m_block=b; }
+
+    block* m_block;
+  };
+
+  //! @brief Pool of fixed size buffers
+  /*! Buffers are allocated by slabs and recycled, so steady state use doesn't allocate. Thread-safe. \n
+      The pool must outlive the buffers it hands out
+  */
+  class buffer_pool
+  {
+  public:
+    //! @brief Constructor
+    /*! @param bufferSize Size of each buffer
+        @param slabCount Number of buffers allocated at once when the pool is empty
+    */
+    buffer_pool(uint32_t bufferSize=4096, uint32_t slabCount=64);
+    ~buffer_pool();
+
+    //! @brief Get a buffer, empty and with a single handle
+    pool_buffer acquire();
+
+    //! @brief Size of each buffer
+    inline uint32_t buffer_size() const { return m_bufferSize; }
+    //! @brief Total number of buffers allocated
+    size_t allocated();
+    //! @brief Number of buffers currently in the pool
+    size_t available();
+
+  private:
+    friend class pool_buffer;
+
+    void release(pool_buffer::block* b);
+
+    uint32_t m_bufferSize;
+    uint32_t m_slabCount;
+    std::vector<std::unique_ptr<pool_buffer::block[]>> m_blocks;
+    std::vector<std::unique_ptr<uint8_t[]>> m_slabs;
+    pool_buffer::block* m_free;
+    size_t m_available;
+    std::mutex m_mtx;
+  };
+
   //! @brief Main socket abstract object
   /*! Abstract object, doesn't work on its own. Provides operations and templates for child classes. \n \n
       Provides automatic background data reading with parallel_on() \n
       Wait for reading of data with wait_data() \n
-      Retrieve data with retrieve() \n
+      Retrieve data with retrieve(), or in place with peek() and consume() \n
+      When reading into a buffer_pool, retrieve data with retrieve_buffer() \n
   */
   class socket_abstract
   {
@@ -36,14 +251,28 @@ namespace ztd
     //! @brief Valid connection established, data can be sent and/or recieved
     inline bool operational() { return m_operational; }
     //! @brief Close connection
+    /*! Also removes the socket from its event_loop, if any
+    */
     void close_socket();
 
+    //! @brief Set the socket as non-blocking
+    /*! On a non-blocking socket, read_data() returns @a False without closing when no data is pending
+        @return @a True if successful, @a False otherwise
+    */
+    bool set_nonblocking(bool enable=true);
+    //! @brief Event loop the socket is registered to, nullptr if none
+    inline event_loop* loop() { return m_loop; }
+
     //! @brief Send string data
+    /*! The terminating null character is sent too
+    */
     bool send_string(std::string const& text);
     //! @brief Recieve string data
     std::string read_string();
     //! @brief Send byte data
-    /*! @param data Array of bytes
+    /*! On a non-blocking socket, data that can't be sent without blocking is queued and sent by flush(),
+        automatically once writable for sockets of an event_loop
+        @param data Array of bytes
         @param size Size of the array
         @return @a True if successful, @a False otherwise
     */
@@ -51,29 +280,109 @@ namespace ztd
     //! @brief Send byte data
     /*! @param data Pre-allocated array of bytes
         @param size Pointer to size of data array. Number of bytes read stored to pointed location if successful reading
-        @return @a True if successful, @a False otherwise
+        @return @a True if successful, @a False otherwise. On a non-blocking socket with no pending data, the socket stays operational
     */
     bool read_data(uint8_t *data, uint32_t *size);
+    //! @brief Send scattered byte data in one call
+    /*! Partial writes are resumed until everything is sent. On a non-blocking socket the rest is queued, see send_data()
+        @param iov Buffers to send, in order
+        @return @a True if successful, @a False otherwise
+    */
+    bool send_iov(std::span<const iovec> iov);
+
+    //! @brief Send a framed message
+    /*! Queued data is flushed first
+        @param framer Framing of the message
+        @param data Message data
+        @param size Size of the message, at most the framer's maximum size. In delimiter mode, data can't contain the delimiter
+        @return @a True if successful, @a False otherwise
+    */
+    bool send_message(message_framer const& framer, uint8_t const* data, size_t size);
+    //! @brief Read until a complete message is available
+    /*! The socket is closed if the message exceeds the framer's maximum size
+        @param framer Framer reassembling the messages of this socket
+        @param message Set to the message. Valid until the next use of @a framer
+        @return @a True if successful, @a False otherwise
+    */
+    bool read_message(message_framer& framer, std::span<const uint8_t>& message);
+
+    //! @brief Send file contents without copying through user space
+    /*! Queued data is flushed first. On a non-blocking socket, contents that can't be sent without blocking are read and queued, see send_data()
+        A closed peer makes the call fail instead of raising SIGPIPE
+        @param fd File descriptor of the file
+        @param offset Start position in the file
+        @param size Number of bytes to send
+        @return @a True if successful, @a False otherwise
+    */
+    bool send_file(int fd, off_t offset, size_t size);
+    //! @brief Move received data into a pipe without copying through user space
+    /*! @param fd Write end of the pipe
+        @param size Maximum number of bytes to move
+        @return Number of bytes moved, 0 if the connection was closed, -1 on error or if nothing can be moved without blocking
+    */
+    ssize_t splice_out(int fd, size_t size);
+    //! @brief Send data from a pipe without copying through user space
+    /*! On a non-blocking socket, data that can't be sent without blocking is read from the pipe and queued, see send_data()
+        A closed peer makes the call fail instead of raising SIGPIPE
+        @param fd Read end of the pipe
+        @param size Number of bytes to send
+        @return @a True if successful, @a False otherwise
+    */
+    bool splice_in(int fd, size_t size);
+
+    //! @brief Queue byte data for the next flush()
+    /*! Consecutive queued data is sent with a single system call. Sockets of an event_loop are flushed after each dispatch. Not thread-safe
+        @param data Array of bytes
+        @param size Size of the array
+        @param copy Copy the data. If @a False, data has to stay valid until flushed
+    */
+    void queue_data(uint8_t const* data, uint32_t size, bool copy=true);
+    //! @brief Queue string data for the next flush(), without terminating null character
+    inline void queue_string(std::string const& text) { queue_data((uint8_t const*) text.data(), text.size()); }
+    //! @brief Size of the queued data
+    inline size_t queued() { return m_queued; }
+    //! @brief Send queued data
+    /*! On a non-blocking socket, data that can't be sent without blocking stays queued. Sockets of an event_loop are then flushed once writable
+        @return @a True if successful, @a False otherwise
+    */
+    bool flush();
 
     //! @brief State of automatic parallel data reading
     inline bool parallel() { return m_parallel; }
     //! @brief Turn on automatic parallel data reading
-    /*! Socket has to be operational. \n Read data stored for later use with retrieve()
-        @param bufferSize size of the reading buffer
+    /*! Socket has to be operational. \n Read data stored for later use with retrieve() \n
+        If a previous reader is still running, waits for it to return from its pending read
+        @param bufferSize size of the reading buffer, rounded up to a power of 2. Reading pauses while it is full
+    */
+    void parallel_on(uint32_t bufferSize=65536);
+    //! @brief Turn on automatic parallel data reading into pooled buffers
+    /*! Socket has to be operational. \n Each read is stored in its own buffer for later use with retrieve_buffer()
+        @param pool Pool of the reading buffers, must outlive the socket
     */
-    void parallel_on(uint32_t bufferSize=256);
+    void parallel_on(buffer_pool* pool);
     //! @brief Turn off automatic parallel data reading
     void parallelOff();
     //! @brief Forcibly kill automatic parallel data reading
     void killParallel();
 
-    inline std::vector<std::vector<uint8_t>>& data() { return m_dataSet; }
+    //! @brief Buffer of data read in parallel
+    inline spsc_ring& data() { return m_ring; }
     //! @brief Data is available
     /*! Parallel reading enabled
     */
-    inline bool data_available() { return m_dataSet.size() > 0; }
-    //! @brief Retrieve pending data (parallel reading)
+    inline bool data_available() { return !m_ring.empty() || m_buffered > 0; }
+    //! @brief Retrieve all pending data (parallel reading)
     std::vector<uint8_t> retrieve();
+    //! @brief Pending data, without copy (parallel reading)
+    /*! Can be shorter than the total pending data, when the buffer wraps around
+    */
+    inline std::span<const uint8_t> peek() { return m_ring.peek(); }
+    //! @brief Release @a n bytes obtained from peek() (parallel reading)
+    void consume(size_t n);
+    //! @brief Retrieve the oldest pending read, without copy (parallel reading into a buffer_pool)
+    /*! @return Empty handle if no data is pending
+    */
+    pool_buffer retrieve_buffer();
 
     inline std::condition_variable& cv() { return m_cv; }
     inline std::mutex& mtx() { return m_mtx; }
@@ -81,19 +390,80 @@ namespace ztd
     void wait_data();
 
   private:
-    static void parallel_reading(socket_abstract *s, uint32_t bufferSize);
+    static void parallel_reading(socket_abstract *s);
+    static void parallel_reading_pool(socket_abstract *s);
+    //! @brief Wait for the reading thread to exit
+    void wait_reader();
+    //! @brief Send buffers until done or the non-blocking socket would block
+    /*! @return Number of bytes sent, -1 on error
+    */
+    ssize_t write_iov(iovec const* iov, size_t count);
+    //! @brief Queue @a size bytes read from @a fd, at @a offset if not null
+    bool queue_fd(int fd, off_t* offset, size_t size);
+    //! @brief Watch writable events of the event loop while data is queued
+    void watch_pending();
+
+    friend class event_loop;
+    friend class io_engine;
 
   protected:
     int m_fd;
-    bool m_operational;
+    std::atomic<bool> m_operational;
+    event_loop* m_loop;
 
-    bool m_parallel;
+    std::atomic<bool> m_parallel;
     std::thread *m_thread;
-    std::vector<std::vector<uint8_t>> m_dataSet;
+    // reading thread is running, guarded by m_mtx
+    bool m_reading;
+    spsc_ring m_ring;
+    buffer_pool* m_pool;
+    pool_buffer::block* m_bufferHead;
+    pool_buffer::block* m_bufferTail;
+    std::atomic<size_t> m_buffered;
+
+    // data queued by queue_data(), segments with a null base are copied in order into m_batch
+    std::vector<iovec> m_segments;
+    std::vector<uint8_t> m_batch;
+    size_t m_queued;
     std::condition_variable m_cv;
     std::mutex m_mtx;
   };
 
+  //! @brief Zero-copy forwarding between sockets
+  /*! Data is moved through a kernel pipe with splice, without passing through user space
+  */
+  class splice_pipe
+  {
+  public:
+    //! @brief Constructor
+    /*! @param size Requested pipe capacity
+    */
+    splice_pipe(size_t size=65536);
+    ~splice_pipe();
+
+    //! @brief Pipe was successfully created
+    inline bool valid() { return m_pipe[0] >= 0; }
+    //! @brief Pipe capacity
+    inline size_t capacity() { return m_capacity; }
+
+    //! @brief Move available data from a socket to another
+    /*! @param from Source socket. Only waits for data if it is blocking
+        @param to Destination socket
+        @param size Maximum number of bytes to move
+        @return Number of bytes moved, 0 if @a from was closed, -1 on error or if no data was available
+    */
+    ssize_t forward(socket_abstract& from, socket_abstract& to, size_t size=SIZE_MAX);
+
+    //! @brief Forward data both ways between two sockets until one is closed
+    /*! @return @a True if ended by a closed connection, @a False on error
+    */
+    static bool proxy(socket_abstract& a, socket_abstract& b);
+
+  private:
+    int m_pipe[2];
+    size_t m_capacity;
+  };
+
   //! @brief TCP socket abstract object
   /*! Abstract object, doesn't work on its own. Provides operations and templates for child classes
   */
@@ -128,6 +498,12 @@ namespace ztd
 
     inline struct sockaddr_in addr() { return m_servaddr; }
 
+    //! @brief Allow several sockets to listen on the same port
+    /*! Set before listening. Connections are balanced between the sockets
+        @return @a True if successful, @a False otherwise
+    */
+    bool set_reuseport(bool enable=true);
+
     //! @brief Open server for IPv4
     /*! @param port Listening port, != 0
         @param backlog Backlog value
@@ -163,26 +539,115 @@ namespace ztd
 
     //! @brief Wait for a client connection.
     /*! Socket becomes operational if connection successful
+        @param nonblocking Accept as a non-blocking socket. Returns @a False immediately if the server is non-blocking and no connection is pending
         @return @a True if a valid connection is established, @a False otherwise
     */
-    bool accept_connection();
+    bool accept_connection(bool nonblocking=false);
 
-    inline struct sockaddr_in client() { return m_cliaddr; }
+    inline struct sockaddr_storage client() { return m_cliaddr; }
     //! @brief Get client address
+    /*! @return IPv4 or IPv6 string address, valid until the next call
+    */
     char* client_address();
     //! @brief Get client port
     uint16_t client_port();
 
   private:
+    friend class io_engine;
+
     tcpsocket_server *m_server;
-    struct sockaddr_in m_cliaddr;
+    struct sockaddr_storage m_cliaddr;
+    char m_cliname[INET6_ADDRSTRLEN];
 
     socklen_t m_clilen;
 
   };
 
+  //! @brief Host name resolution
+  /*! Thread-safe getaddrinfo() resolution. Results are cached for a short time
+  */
+  class resolver
+  {
+  public:
+    //! @brief Resolved socket address
+    struct address {
+      struct sockaddr_storage addr;
+      socklen_t len;
+      //! @brief Address family, AF_INET or AF_INET6
+      inline int family() const { return addr.ss_family; }
+    };
+
+    //! @brief Resolve a host name or numeric address
+    /*! @param host Host name, IPv4 or IPv6 address
+        @param port Port set in the resulting addresses
+        @param family AF_INET, AF_INET6 or AF_UNSPEC for both
+        @param timeout Timeout in milliseconds, -1 for none. A lookup still running when it expires is left to finish in the background
+        @return Addresses in preference order, empty if resolution failed
+    */
+    static std::vector<address> resolve(std::string const& host, uint16_t port, int family=AF_UNSPEC, int timeout=-1);
+
+    //! @brief Duration results are cached. 0 disables caching
+    static void set_ttl(std::chrono::milliseconds ttl);
+    //! @brief Empty the cache
+    static void clear();
+  };
+
+  //! @brief TCP server accepting on several threads
+  /*! Opens one SO_REUSEPORT listener per worker, each accepting on its own thread, so the kernel spreads connections between workers. \n
+      Run listen_ipv4() or listen_ipv6(), then start()
+  */
+  class reuseport_server
+  {
+  public:
+    //! @brief New connection callback, called on the accepting worker's thread. The callback takes ownership of the instance
+    typedef std::function<void(tcpsocket_server_instance*, unsigned int worker)> accept_callback;
+
+    reuseport_server();
+    ~reuseport_server();
+
+    //! @brief Open listeners for IPv4
+    /*! @param port Listening port, != 0
+        @param workers Number of listeners, 0 for one per CPU
+        @param backlog Backlog value of each listener
+        @return @a True if successful, @a False otherwise
+    */
+    bool listen_ipv4(uint16_t port, unsigned int workers=0, int backlog=SOMAXCONN);
+    //! @brief Open listeners for IPv6
+    /*! @param port Listening port, != 0
+        @param workers Number of listeners, 0 for one per CPU
+        @param backlog Backlog value of each listener
+        @return @a True if successful, @a False otherwise
+    */
+    bool listen_ipv6(uint16_t port, unsigned int workers=0, int backlog=SOMAXCONN);
+
+    //! @brief Start accepting
+    /*! Accepted connections are non-blocking
+        @param on_accept Callback for new connections
+        @param pin Pin worker @a i to CPU @a i, and steer connections handled on that CPU to its listener
+        @return @a True if successful, @a False otherwise
+    */
+    bool start(accept_callback on_accept, bool pin=false);
+    //! @brief Stop accepting and wait for the workers to return
+    void stop();
+
+    //! @brief Number of listeners
+    inline size_t size() { return m_listeners.size(); }
+    //! @brief Listener of a worker
+    inline tcpsocket_server& listener(size_t i) { return *m_listeners[i]; }
+
+  private:
+    bool open(uint16_t port, unsigned int workers, int backlog, bool ipv6);
+    void work(unsigned int worker);
+
+    std::vector<std::unique_ptr<tcpsocket_server>> m_listeners;
+    std::vector<std::thread> m_threads;
+    accept_callback m_onAccept;
+    int m_evfd;
+  };
+
   //! @brief TCP client
   /*! Can send/read data. Refer to socket_abstract methods \n
+    Run connect() for an operational connection over IPv4 or IPv6 \n
     Run init_ipv4() then connect_ipv4() for an operational IPv4 connection \n
     Run init_ipv6() then connect_ipv6() for an operational IPv6 connection
   */
@@ -192,18 +657,29 @@ namespace ztd
     tcpsocket_client();
     virtual ~tcpsocket_client();
 
+    //! @brief Connect to a TCP server over any resolved address
+    /*! Doesn't need init. Addresses are tried in parallel with staggered starts ("happy eyeballs"): the next address is tried if the previous one hasn't connected after @a attemptDelay, and the first successful connection is kept
+        @param host Host name or address of the target server
+        @param port Port of the target server
+        @param timeout Timeout in milliseconds including name resolution, -1 for none
+        @param attemptDelay Delay in milliseconds before trying the next address
+        @return @a True if successful, @a False otherwise
+    */
+    bool connect(std::string const& host, uint16_t port, int timeout=-1, int attemptDelay=250);
     //! @brief Connect to an IPv4 TCP server
-    /*! @param addr IPv4 string address of the target server
+    /*! @param addr IPv4 string address or host name of the target server
         @param port Port of the target server
+        @param timeout Timeout in milliseconds including name resolution, -1 for none
         @return @a True if successful, @a False otherwise
     */
-    bool connect_ipv4(std::string const& addr, uint16_t port);
+    bool connect_ipv4(std::string const& addr, uint16_t port, int timeout=-1);
     //! @brief Connect to an IPv6 TCP server
-    /*! @param addr IPv6 string address of the target server
-    @param port Port of the target server
-    @return @a True if successful, @a False otherwise
+    /*! @param addr IPv6 string address or host name of the target server
+        @param port Port of the target server
+        @param timeout Timeout in milliseconds including name resolution, -1 for none
+        @return @a True if successful, @a False otherwise
     */
-    bool connect_ipv6(std::string const& addr, uint16_t port);
+    bool connect_ipv6(std::string const& addr, uint16_t port, int timeout=-1);
 
     //! @brief String address of target server
     inline std::string addr() { return m_addr; }
@@ -212,12 +688,246 @@ namespace ztd
 
 
     private:
-      struct hostent *m_server;
-      struct sockaddr_in m_servaddr;
+      bool connect_family(std::string const& addr, uint16_t port, int family, int timeout);
+
+      struct sockaddr_storage m_servaddr;
       std::string m_addr;
       uint16_t m_port;
     };
 
+  //! @brief Pool of client connections
+  /*! Keeps idle connections per host and port for reuse, saving a handshake per request. Thread-safe. \n
+      Idle connections are checked for a closed or failed peer when checked out, and closed after an idle timeout. \n
+      Every connection obtained with checkout() has to be given back with checkin(), including closed ones
+  */
+  class connection_pool
+  {
+  public:
+    //! @brief Constructor
+    /*! @param maxSize Maximum number of connections per host and port, idle or checked out. 0 for no limit
+        @param maxIdle Maximum number of idle connections kept per host and port
+        @param minIdle Number of idle connections per host and port kept beyond the idle timeout
+        @param idleTimeout Duration after which an idle connection is closed
+        @param connectTimeout Timeout of new connections in milliseconds, -1 for none
+    */
+    connection_pool(size_t maxSize=0, size_t maxIdle=8, size_t minIdle=0, std::chrono::milliseconds idleTimeout=std::chrono::seconds(60), int connectTimeout=-1);
+    ~connection_pool();
+
+    //! @brief Get a connection
+    /*! Reuses the most recent live idle connection, or opens a new one
+        @return Operational connection, nullptr if connecting failed or the maximum size is reached
+    */
+    tcpsocket_client* checkout(std::string const& host, uint16_t port);
+    //! @brief Give back a connection from checkout()
+    /*! Operational connections become idle, others are deleted
+    */
+    void checkin(tcpsocket_client* client);
+
+    //! @brief Close idle connections past the idle timeout
+    /*! Also done on checkout() and checkin() of the same host and port
+    */
+    void evict();
+    //! @brief Close all idle connections
+    void clear();
+
+    //! @brief Total number of idle connections
+    size_t idle();
+    //! @brief Number of connections to a host and port that are checked out
+    size_t active(std::string const& host, uint16_t port);
+
+    //! @brief Connection is established and the peer didn't close or fail it
+    static bool alive(socket_abstract* socket);
+
+  private:
+    struct idle_connection {
+      tcpsocket_client* client;
+      std::chrono::steady_clock::time_point since;
+    };
+    struct host_pool {
+      // oldest first, reused from the back
+      std::deque<idle_connection> idle;
+      size_t active=0;
+    };
+
+    static std::string key(std::string const& host, uint16_t port);
+    void evict(host_pool& pool, std::chrono::steady_clock::time_point now, std::vector<tcpsocket_client*>& closed);
+
+    size_t m_maxSize;
+    size_t m_maxIdle;
+    size_t m_minIdle;
+    std::chrono::milliseconds m_idleTimeout;
+    int m_connectTimeout;
+    std::unordered_map<std::string, host_pool> m_pools;
+    std::mutex m_mtx;
+  };
+
+  //! @brief Socket event loop
+  /*! Dispatches socket events from epoll on one or several threads instead of one reading thread per socket. \n
+      Registered sockets are set non-blocking and watched edge-triggered: callbacks must read until read_data() returns @a False. \n
+      A socket is never dispatched on two threads at once. \n \n
+      Add listening servers with add_server(), connected sockets with add() \n
+      Run the loop with run() or run_once()
+  */
+  class event_loop
+  {
+  public:
+    //! @brief Socket event callback
+    typedef std::function<void(socket_abstract*)> event_callback;
+    //! @brief New connection callback. The callback takes ownership of the instance
+    typedef std::function<void(tcpsocket_server_instance*)> accept_callback;
+
+    event_loop();
+    ~event_loop();
+
+    //! @brief Loop was successfully created
+    inline bool valid() { return m_epfd >= 0; }
+
+    //! @brief Register a listening server
+    /*! Pending connections are accepted as non-blocking tcpsocket_server_instance and given to @a on_accept
+        @return @a True if successful, @a False otherwise
+    */
+    bool add_server(tcpsocket_server* server, accept_callback on_accept);
+    //! @brief Register an operational socket
+    /*! @param on_read Called when data is readable
+        @param on_write Called when the socket is writable, see watch_write()
+        @param on_close Called once the peer hung up or the socket was closed during a callback. The socket is already removed from the loop and may be deleted
+        @return @a True if successful, @a False otherwise
+    */
+    bool add(socket_abstract* socket, event_callback on_read, event_callback on_write=nullptr, event_callback on_close=nullptr);
+    //! @brief Unregister a socket
+    /*! Called automatically on close_socket(). Doesn't call the close callback
+    */
+    bool remove(socket_abstract* socket);
+    //! @brief Enable or disable writable events for a socket
+    bool watch_write(socket_abstract* socket, bool enable=true);
+
+    //! @brief Wait for events and dispatch them once
+    /*! @param timeout Timeout in milliseconds, -1 for infinite
+        @return Number of events processed, -1 on error
+    */
+    int run_once(int timeout=-1);
+    //! @brief Dispatch events until stop() is called
+    /*! @param threads Number of threads dispatching events, including the calling thread
+    */
+    void run(unsigned int threads=1);
+    //! @brief Make run() return
+    void stop();
+
+  private:
+    friend class socket_abstract;
+
+    struct handler {
+      socket_abstract* socket;
+      tcpsocket_server* server;
+      accept_callback on_accept;
+      event_callback on_read;
+      event_callback on_write;
+      event_callback on_close;
+      bool write=false;
+      bool busy=false;
+      // server out of descriptors, left unarmed until the backoff timer expires
+      bool paused=false;
+    };
+
+    std::shared_ptr<handler> get_handler(int fd);
+    bool attach(std::shared_ptr<handler> h);
+    bool arm(int fd, handler* h, int op);
+    //! @brief Re-arm after data was queued outside of a dispatch
+    bool rearm(socket_abstract* socket);
+    void dispatch(int fd, uint32_t events);
+    //! @brief Re-arm paused servers once the backoff timer expired
+    void resume();
+
+    int m_epfd;
+    int m_evfd;
+    int m_timerfd;
+    std::atomic<bool> m_stop;
+    std::unordered_map<int, std::shared_ptr<handler>> m_handlers;
+    std::mutex m_mtx;
+  };
+
+  //! @brief Completion based socket I/O engine
+  /*! Drives accept, receive, send and close through io_uring when the kernel supports it (Linux 6.0 and later),
+      with multishot accept and multishot receive into kernel provided buffers. Operations issued during a dispatch are submitted together on the next run_once(). \n
+      Falls back to an event_loop otherwise, see uring(). \n \n
+      The engine is single threaded: except stop(), methods are to be called from callbacks or from the thread running it. \n
+      Registered sockets are closed with close(), not close_socket()
+  */
+  class io_engine
+  {
+  public:
+    //! @brief Data received callback. Data is only valid during the call
+    typedef std::function<void(socket_abstract*, uint8_t const*, uint32_t)> data_callback;
+    typedef event_loop::event_callback event_callback;
+    typedef event_loop::accept_callback accept_callback;
+
+    //! @brief Constructor
+    /*! @param entries Size of the submission queue
+        @param bufferCount Number of receive buffers, up to 65536
+        @param bufferSize Size of each receive buffer
+    */
+    io_engine(unsigned int entries=256, uint32_t bufferCount=256, uint32_t bufferSize=4096);
+    ~io_engine();
+
+    //! @brief io_uring is in use. @a False if running on the event_loop fallback
+    inline bool uring() { return m_uring != nullptr; }
+    //! @brief Engine was successfully created
+    bool valid();
+
+    //! @brief Register a listening server
+    /*! Accepted connections are given to @a on_accept, which takes ownership
+        @return @a True if successful, @a False otherwise
+    */
+    bool add_server(tcpsocket_server* server, accept_callback on_accept);
+    //! @brief Register an operational socket
+    /*! @param on_data Called with each received segment
+        @param on_close Called once the connection is closed, by close() or by the peer. The socket may then be deleted
+        @return @a True if successful, @a False otherwise
+    */
+    bool add(socket_abstract* socket, data_callback on_data, event_callback on_close=nullptr);
+    //! @brief Queue data for sending
+    /*! Data is copied. Sends on a socket are performed in order
+        @return @a True if successful, @a False otherwise
+    */
+    bool send(socket_abstract* socket, uint8_t const* data, uint32_t size);
+    //! @brief Close a registered socket once its pending sends are done
+    bool close(socket_abstract* socket);
+
+    //! @brief Submit pending operations, wait for completions and dispatch them
+    /*! @param timeout Timeout in milliseconds, -1 for infinite
+        @return Number of completions processed, -1 on error
+    */
+    int run_once(int timeout=-1);
+    //! @brief Dispatch completions until stop() is called
+    void run();
+    //! @brief Make run() return. Can be called from any thread
+    void stop();
+
+    //! @brief io_uring state, defined by the implementation
+    struct ring;
+
+  private:
+    struct conn;
+
+    bool uring_init(unsigned int entries, uint32_t bufferCount, uint32_t bufferSize);
+    void uring_free();
+    void submit_accept(conn* c);
+    void submit_backoff(conn* c);
+    void submit_recv(conn* c);
+    void submit_send(conn* c);
+    void submit_wake();
+    void begin_close(conn* c);
+    void finish(conn* c);
+    void complete(uint64_t data, int32_t res, uint32_t flags);
+
+    ring* m_uring;
+    std::unique_ptr<event_loop> m_fallback;
+    std::vector<uint8_t> m_buffer;
+    std::unordered_map<socket_abstract*, conn*> m_conns;
+    int m_evfd;
+    std::atomic<bool> m_stop;
+  };
+
 }
 
 
@@ -1,13 +1,24 @@
 #include "filedat.hpp"
 
 #include <algorithm>
+#include <thread>
+#include <sstream>
+#include <cctype>
 
-// Function code
-bool ztd::filedat::isRead(char in)
-{
-  return in>=33 && in<=126;
-}
+#include <unistd.h>
+#include <fcntl.h>
+
+#ifdef ZTD_ZLIB
+#include <zlib.h>
+#endif
+#ifdef ZTD_ZSTD
+#include <zstd.h>
+#endif
 
+#define FILE_BLOCK_SIZE 65536
+#define JSON_MAX_DEPTH 1024
+
+// Function code
 static std::string repeatString(const std::string& str, const unsigned int n)
 {
   std::string ret;
@@ -16,39 +27,107 @@ static std::string repeatString(const std::string& str, const unsigned int n)
   return ret;
 }
 
-static std::string escape(std::string str, const char c)
+static size_t hash_combine(size_t seed, size_t val)
+{
+  return seed ^ (val + 0x9e3779b97f4a7c15 + (seed << 6) + (seed >> 2));
+}
+
+// heap bytes of a string, 0 if stored inline
+template <class S>
+static size_t _string_heap(S const& str)
+{
+  const char* p = str.data();
+  if(p >= (const char*) &str && p < (const char*) (&str+1))
+    return 0;
+  return str.capacity()+1;
+}
+
+// chunk objects are preceded by their memory resource and size, for deletion
+struct _chunk_header
+{
+  std::pmr::memory_resource* resource;
+  size_t size;
+};
+static constexpr size_t _chunk_header_size = alignof(std::max_align_t) > sizeof(_chunk_header) ? alignof(std::max_align_t) : sizeof(_chunk_header);
+
+static void indent(std::ostream& stream, const std::string& aligner, const unsigned int n)
+{
+  for(unsigned int i=0 ; i<n ; i++)
+    stream << aligner;
+}
+
+// write str with c and backslashes escaped
+static void escape(std::ostream& stream, std::string_view str, const char c)
 {
-  size_t pos = str.find(c);
-  while(pos != std::string::npos)
+  const char special[2] = {c, '\\'};
+  size_t i=0, pos;
+  // write clean runs at once
+  while( (pos = str.find_first_of(std::string_view(special, 2), i)) != std::string_view::npos )
   {
-    str.insert(pos, "\\");
-    pos += 2;
-    pos = str.find(c, pos);
+    stream.write(str.data()+i, pos-i);
+    stream << '\\' << str[pos];
+    i = pos+1;
   }
-  return str;
+  stream.write(str.data()+i, str.size()-i);
 }
 
-void ztd::printErrorIndex(const char* in, const int index, const std::string& message, const std::string& origin)
+// key can be written without quotes: alphanumeric, _-. and non-ASCII chars
+static bool _plain_key(std::string_view key)
 {
-  int i=0, j=0; // j: last newline
-  int line=1; //n: line #
-  int in_size=strlen(in);
-  if(index >= 0)
+  if(key.size() == 0)
+    return false;
+  for(char c : key)
   {
-    while(i < in_size && i < index)
-    {
-      if(in[i] == '\n')
-      {
-        line++;
-        j=i+1;
-      }
-      i++;
-    }
-    while(i < in_size && in[i]!='\n')
-    {
-      i++;
-    }
+    if(!isalnum((unsigned char) c) && c != '_' && c != '-' && c != '.' && (unsigned char) c < 0x80)
+      return false;
   }
+  return true;
+}
+
+// position of closing quote, from start of quoted content. npos if quote doesn't close
+static size_t _quote_end(std::string const& str, const size_t start, const char quote)
+{
+  size_t i=start;
+  const char* data = str.data();
+  const char* p;
+  while( (p = (const char*) memchr(data+i, quote, str.size()-i)) != nullptr )
+  {
+    size_t pos = p-data;
+    size_t n=0; // preceding backslashes
+    while(pos-n > start && data[pos-n-1] == '\\')
+      n++;
+    if(n%2 == 0) // not escaped
+      return pos;
+    i = pos+1;
+  }
+  return std::string::npos;
+}
+
+// append quoted content to out, unescaping quotes and backslashes. Other backslashes are kept as is
+// Returns position of closing quote, npos if quote doesn't close
+static size_t _unescape(std::string& out, std::string const& str, const size_t start, const char quote)
+{
+  size_t end = _quote_end(str, start, quote);
+  if(end == std::string::npos)
+    return end;
+  size_t i=start;
+  const char* data = str.data();
+  const char* p;
+  while( (p = (const char*) memchr(data+i, '\\', end-i)) != nullptr )
+  {
+    size_t pos = p-data;
+    out.append(data+i, pos-i);
+    if(pos+1 < end && (data[pos+1] == quote || data[pos+1] == '\\')) // escaped char: skip backslash
+      pos++;
+    out += data[pos];
+    i = pos+1;
+  }
+  out.append(data+i, end-i);
+  return end;
+}
+
+static void _printErrorLine(const char* in, const int index, const int line, const int j, const int i, const std::string& message, const std::string& origin)
+{
   if(origin != "")
   {
     std::cerr << origin << ": Error\nLine " << line << " col " << index-j+1 << ": " << message << std::endl;
@@ -68,6 +147,89 @@ void ztd::printErrorIndex(const char* in, const int index, const std::string& me
   }
 }
 
+void ztd::printErrorIndex(const char* in, const int index, const std::string& message, const std::string& origin)
+{
+  int i=0, j=0; // j: last newline
+  int line=1; //n: line #
+  if(index >= 0)
+  {
+    // only scan data up to the error
+    int n=strnlen(in, index);
+    const char* p=in;
+    while( (p = (const char*) memchr(p, '\n', in+n-p)) != nullptr )
+    {
+      p++;
+      line++;
+      j=p-in;
+    }
+    i = strchrnul(in+n, '\n') - in;
+  }
+  _printErrorLine(in, index, line, j, i, message, origin);
+}
+
+void ztd::printErrorIndex(ztd::line_index const& lines, const char* in, const int index, const std::string& message, const std::string& origin)
+{
+  int i=0, j=0;
+  int line=1;
+  if(index >= 0)
+  {
+    line = lines.location(index).first;
+    j = lines.line_start(line);
+    i = lines.line_end(line);
+  }
+  _printErrorLine(in, index, line, j, i, message, origin);
+}
+
+ztd::line_index::line_index()
+{
+  m_starts.push_back(0);
+  m_size=0;
+}
+
+ztd::line_index::line_index(const char* data, size_t size)
+{
+  this->set(data, size);
+}
+
+void ztd::line_index::set(const char* data, size_t size)
+{
+  m_starts.clear();
+  m_starts.push_back(0);
+  m_size=size;
+  const char* p=data;
+  const char* end=data+size;
+  // memchr is vectorized
+  while( (p = (const char*) memchr(p, '\n', end-p)) != nullptr )
+  {
+    p++;
+    m_starts.push_back(p-data);
+  }
+}
+
+std::pair<unsigned int, unsigned int> ztd::line_index::location(size_t offset) const
+{
+  unsigned int line = std::upper_bound(m_starts.begin(), m_starts.end(), offset) - m_starts.begin();
+  return std::make_pair(line, offset - m_starts[line-1] + 1);
+}
+
+size_t ztd::line_index::line_start(unsigned int line) const
+{
+  if(line < 1)
+    return 0;
+  if(line > m_starts.size())
+    return m_size;
+  return m_starts[line-1];
+}
+
+size_t ztd::line_index::line_end(unsigned int line) const
+{
+  if(line < 1)
+    line = 1;
+  if(line >= m_starts.size())
+    return m_size;
+  return m_starts[line]-1;
+}
+
 std::string ztd::filedat::removeComments(std::string str)
 {
   uint32_t i=0;
@@ -80,33 +242,17 @@ std::string ztd::filedat::removeComments(std::string str)
     }
     else if( str[i] == '"') // double quotes
     {
-      uint32_t j=i;
-      i++;
-      while(i < str.size() && str[i]!='"') // until end of quote
-      {
-        if(i+1 < str.size() && str[i] == '\\' && str[i+1] == '"') //escaped quote
-          i++; //ignore backslash
-
-        i++; // add char and increment
-      }
-      if(i >= str.size()) // quote didn't end
-        throw ztd::format_error("Double quote doesn't close", "", str, j);
-      i++;
+      size_t e = _quote_end(str, i+1, '"');
+      if(e == std::string::npos) // quote didn't end
+        throw ztd::format_error("Double quote doesn't close", "", str, i);
+      i = e+1;
     }
     else if( str[i] == '\'') // single quotes
     {
-      uint32_t j=i;
-      i++;
-      while(i < str.size() && str[i]!='\'') // until end of quote
-      {
-        if(i+1 < str.size() && str[i] == '\\' && str[i+1] == '\'') //escaped quote
-          i++; //ignore backslash
-
-        i++; // add char
-      }
-      if(i >= str.size()) // quote didn't end
-        throw ztd::format_error("Single quote doesn't close", "", str, j);
-      i++;
+      size_t e = _quote_end(str, i+1, '\'');
+      if(e == std::string::npos) // quote didn't end
+        throw ztd::format_error("Single quote doesn't close", "", str, i);
+      i = e+1;
     }
     else if(str[i] == '#' || (i+1 < str.size() && str.substr(i,2) == "//")) // comment
     {
@@ -122,13 +268,21 @@ std::string ztd::filedat::removeComments(std::string str)
 
 ztd::filedat::filedat()
 {
-  m_dataChunk = new ztd::chunkdat();
+  m_resource = ztd::chunk_default_resource();
+  m_dataChunk = new (m_resource) ztd::chunkdat(m_resource);
+  m_lines_valid=false;
+  m_lazy=false;
+  m_format=ztd::filedat::zfd;
 }
 
 ztd::filedat::filedat(std::string const& in)
 {
-  m_dataChunk = new ztd::chunkdat();
+  m_resource = ztd::chunk_default_resource();
+  m_dataChunk = new (m_resource) ztd::chunkdat(m_resource);
   m_filePath=in;
+  m_lines_valid=false;
+  m_lazy=false;
+  m_format=ztd::filedat::zfd;
 }
 
 ztd::filedat::~filedat()
@@ -140,10 +294,24 @@ ztd::filedat::~filedat()
 void ztd::filedat::clear()
 {
   m_data="";
+  m_lines_valid=false;
   if(m_dataChunk!=nullptr)
   {
     delete m_dataChunk;
-    m_dataChunk = new ztd::chunkdat();
+    m_dataChunk = new (m_resource) ztd::chunkdat(m_resource);
+  }
+}
+
+void ztd::filedat::setResource(std::pmr::memory_resource* resource)
+{
+  if(resource == m_resource)
+    return;
+  m_resource = resource;
+  if(m_dataChunk != nullptr)
+  {
+    ztd::chunkdat* chk = new (m_resource) ztd::chunkdat(*m_dataChunk, m_resource);
+    delete m_dataChunk;
+    m_dataChunk = chk;
   }
 }
 
@@ -156,22 +324,239 @@ bool ztd::filedat::readTest() const
     return true;
 }
 
+// Compressed data
+
+static ztd::filedat::compressionEnum _detect_compression(const char* data, size_t size)
+{
+  if(size >= 2 && (uint8_t) data[0] == 0x1f && (uint8_t) data[1] == 0x8b)
+    return ztd::filedat::gzip;
+  if(size >= 4 && (uint8_t) data[0] == 0x28 && (uint8_t) data[1] == 0xb5 && (uint8_t) data[2] == 0x2f && (uint8_t) data[3] == 0xfd)
+    return ztd::filedat::zstd;
+  return ztd::filedat::no_compression;
+}
+
+#ifdef ZTD_ZLIB
+// decompress stream into out, starting with already read data
+static void _read_gzip(std::istream& st, char* buf, size_t size, std::string& out, std::string const& path)
+{
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if(inflateInit2(&zs, 15+32) != Z_OK) // 32: detect gzip header
+    throw std::runtime_error("Cannot init decompression of '" + path + '\'');
+  int ret=Z_OK;
+  while(size > 0 && ret != Z_STREAM_END)
+  {
+    zs.next_in = (Bytef*) buf;
+    zs.avail_in = size;
+    do
+    {
+      // decompress straight into output
+      size_t pos = out.size();
+      out.resize(pos + FILE_BLOCK_SIZE);
+      zs.next_out = (Bytef*) &out[pos];
+      zs.avail_out = FILE_BLOCK_SIZE;
+      ret = inflate(&zs, Z_NO_FLUSH);
+      out.resize(pos + FILE_BLOCK_SIZE - zs.avail_out);
+      if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+      {
+        inflateEnd(&zs);
+        throw std::runtime_error("Corrupted gzip data in '" + path + '\'');
+      }
+    } while(zs.avail_out == 0 && ret != Z_STREAM_END);
+    st.read(buf, FILE_BLOCK_SIZE);
+    size = st.gcount();
+  }
+  inflateEnd(&zs);
+  if(ret != Z_STREAM_END)
+    throw std::runtime_error("Truncated gzip data in '" + path + '\'');
+}
+#endif
+
+#ifdef ZTD_ZSTD
+// decompress stream into out, starting with already read data
+static void _read_zstd(std::istream& st, char* buf, size_t size, std::string& out, std::string const& path)
+{
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  if(dctx == nullptr)
+    throw std::runtime_error("Cannot init decompression of '" + path + '\'');
+  size_t ret=1;
+  while(size > 0)
+  {
+    ZSTD_inBuffer in = { buf, size, 0 };
+    while(in.pos < in.size)
+    {
+      // decompress straight into output
+      size_t pos = out.size();
+      out.resize(pos + FILE_BLOCK_SIZE);
+      ZSTD_outBuffer zout = { &out[pos], FILE_BLOCK_SIZE, 0 };
+      ret = ZSTD_decompressStream(dctx, &zout, &in);
+      out.resize(pos + zout.pos);
+      if(ZSTD_isError(ret))
+      {
+        ZSTD_freeDCtx(dctx);
+        throw std::runtime_error("Corrupted zstd data in '" + path + "': " + ZSTD_getErrorName(ret));
+      }
+    }
+    st.read(buf, FILE_BLOCK_SIZE);
+    size = st.gcount();
+  }
+  ZSTD_freeDCtx(dctx);
+  if(ret != 0)
+    throw std::runtime_error("Truncated zstd data in '" + path + '\'');
+}
+#endif
+
+// stream buffer compressing into another stream
+class compress_streambuf : public std::streambuf
+{
+public:
+  compress_streambuf(std::ostream& out) : m_stream(out) { setp(m_in, m_in+FILE_BLOCK_SIZE); }
+  virtual ~compress_streambuf() { }
+
+  //! compress remaining data and end compressed stream
+  inline bool finish() { return this->compress(true) && m_stream.flush(); }
+
+protected:
+  int overflow(int c)
+  {
+    if(!this->compress(false))
+      return traits_type::eof();
+    if(c != traits_type::eof())
+    {
+      *pptr() = c;
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+  int sync() { return this->compress(false) ? 0 : -1; }
+
+  //! compress put area and reset it
+  virtual bool compress(bool end) = 0;
+
+  std::ostream& m_stream;
+  char m_in[FILE_BLOCK_SIZE];
+  char m_out[FILE_BLOCK_SIZE];
+};
+
+#ifdef ZTD_ZLIB
+class gzip_streambuf : public compress_streambuf
+{
+public:
+  gzip_streambuf(std::ostream& out) : compress_streambuf(out)
+  {
+    memset(&m_zs, 0, sizeof(m_zs));
+    m_ok = deflateInit2(&m_zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15+16, 8, Z_DEFAULT_STRATEGY) == Z_OK; // 16: gzip header
+  }
+  ~gzip_streambuf() { if(m_ok) deflateEnd(&m_zs); }
+
+protected:
+  bool compress(bool end)
+  {
+    if(!m_ok)
+      return false;
+    int ret;
+    m_zs.next_in = (Bytef*) pbase();
+    m_zs.avail_in = pptr() - pbase();
+    do
+    {
+      m_zs.next_out = (Bytef*) m_out;
+      m_zs.avail_out = FILE_BLOCK_SIZE;
+      ret = deflate(&m_zs, end ? Z_FINISH : Z_NO_FLUSH);
+      if(ret == Z_STREAM_ERROR)
+        return false;
+      m_stream.write(m_out, FILE_BLOCK_SIZE - m_zs.avail_out);
+    } while(m_zs.avail_out == 0 || (end && ret != Z_STREAM_END));
+    setp(m_in, m_in+FILE_BLOCK_SIZE);
+    return m_stream.good();
+  }
+
+private:
+  z_stream m_zs;
+  bool m_ok;
+};
+#endif
+
+#ifdef ZTD_ZSTD
+class zstd_streambuf : public compress_streambuf
+{
+public:
+  zstd_streambuf(std::ostream& out) : compress_streambuf(out) { m_cctx = ZSTD_createCCtx(); }
+  ~zstd_streambuf() { ZSTD_freeCCtx(m_cctx); }
+
+protected:
+  bool compress(bool end)
+  {
+    if(m_cctx == nullptr)
+      return false;
+    ZSTD_inBuffer in = { pbase(), (size_t) (pptr() - pbase()), 0 };
+    bool done;
+    do
+    {
+      ZSTD_outBuffer out = { m_out, FILE_BLOCK_SIZE, 0 };
+      size_t ret = ZSTD_compressStream2(m_cctx, &out, &in, end ? ZSTD_e_end : ZSTD_e_continue);
+      if(ZSTD_isError(ret))
+        return false;
+      m_stream.write(m_out, out.pos);
+      done = end ? ret == 0 : in.pos == in.size;
+    } while(!done);
+    setp(m_in, m_in+FILE_BLOCK_SIZE);
+    return m_stream.good();
+  }
+
+private:
+  ZSTD_CCtx* m_cctx;
+};
+#endif
+
 void ztd::filedat::import_file(const std::string& path)
 {
   if(path != "")
     m_filePath=path;
-  std::ifstream st(m_filePath);
+  std::ifstream st(m_filePath, std::ios::binary);
   if(!st)
     throw std::runtime_error("Cannot read file '" + m_filePath + '\'');
 
   this->clear();
-  std::string line;
 
-  while(st)
+  char* buf = new char[FILE_BLOCK_SIZE];
+  try
   {
-    getline(st, line);
-    m_data += (line + '\n');
+    st.read(buf, FILE_BLOCK_SIZE);
+    size_t size = st.gcount();
+    ztd::filedat::compressionEnum compression = _detect_compression(buf, size);
+    if(compression == ztd::filedat::gzip)
+    {
+#ifdef ZTD_ZLIB
+      _read_gzip(st, buf, size, m_data, m_filePath);
+#else
+      throw std::runtime_error("Cannot read gzip file '" + m_filePath + "': built without zlib support");
+#endif
+    }
+    else if(compression == ztd::filedat::zstd)
+    {
+#ifdef ZTD_ZSTD
+      _read_zstd(st, buf, size, m_data, m_filePath);
+#else
+      throw std::runtime_error("Cannot read zstd file '" + m_filePath + "': built without zstd support");
+#endif
+    }
+    else
+    {
+      while(size > 0)
+      {
+        m_data.append(buf, size);
+        st.read(buf, FILE_BLOCK_SIZE);
+        size = st.gcount();
+      }
+    }
   }
+  catch(...)
+  {
+    delete[] buf;
+    throw;
+  }
+  delete[] buf;
+  m_data += '\n';
   this->generateChunk();
 }
 
@@ -196,112 +581,343 @@ void ztd::filedat::import_string(const std::string& data)
   this->generateChunk();
 }
 
-bool ztd::filedat::export_file(std::string const& path, std::string const& aligner) const
+void ztd::filedat::import_many(std::vector<std::string> const& paths, bool overwrite, unsigned int threads)
+{
+  this->clear();
+  if(threads == 0)
+    threads = std::thread::hardware_concurrency();
+  if(threads == 0)
+    threads = 1;
+  if(threads > paths.size())
+    threads = paths.size();
+
+  // parse in parallel
+  std::vector<ztd::filedat> files(paths.size());
+  std::vector<std::exception_ptr> errors(paths.size());
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    size_t i;
+    while( (i = next++) < paths.size() )
+    {
+      try
+      {
+        files[i].setLazy(m_lazy);
+        files[i].setFormat(m_format);
+        files[i].import_file(paths[i]);
+      }
+      catch(...)
+      {
+        errors[i] = std::current_exception();
+      }
+    }
+  };
+  std::vector<std::thread> pool;
+  for(unsigned int i=1 ; i<threads ; i++)
+    pool.push_back(std::thread(worker));
+  worker();
+  for(auto& it : pool)
+    it.join();
+
+  // first error in order
+  for(auto& it : errors)
+  {
+    if(it)
+      std::rethrow_exception(it);
+  }
+
+  // merge in order
+  for(size_t i=0 ; i<files.size() ; i++)
+  {
+    try
+    {
+      m_dataChunk->merge(std::move(files[i].data()), overwrite);
+    }
+    catch(ztd::format_error& e)
+    {
+      throw ztd::format_error(e.what(), paths[i], e.data(), e.where());
+    }
+  }
+}
+
+static void _write_chunk(std::ostream& stream, ztd::chunkdat const* data, std::string const& aligner, ztd::filedat::formatEnum format)
 {
-  std::ofstream stream;
-  if(path=="")
-    stream.open(m_filePath);
+  if(data == nullptr)
+    return;
+  if(format == ztd::filedat::json)
+    data->write_json(stream, 0, aligner);
   else
-    stream.open(path);
+    data->write(stream, 0, aligner);
+}
+
+static bool _write_file(std::string const& path, ztd::chunkdat const* data, std::string const& aligner, ztd::filedat::compressionEnum compression, ztd::filedat::formatEnum format)
+{
+  // compression not supported
+#ifndef ZTD_ZLIB
+  if(compression == ztd::filedat::gzip)
+    return false;
+#endif
+#ifndef ZTD_ZSTD
+  if(compression == ztd::filedat::zstd)
+    return false;
+#endif
+
+  std::ofstream stream(path, std::ios::binary);
   if(!stream)
     return false;
-  stream << this->strval(aligner);
-  return true;
+
+  compress_streambuf* buf=nullptr;
+#ifdef ZTD_ZLIB
+  if(compression == ztd::filedat::gzip)
+    buf = new gzip_streambuf(stream);
+#endif
+#ifdef ZTD_ZSTD
+  if(compression == ztd::filedat::zstd)
+    buf = new zstd_streambuf(stream);
+#endif
+  bool ret;
+  if(buf == nullptr)
+  {
+    _write_chunk(stream, data, aligner, format);
+    ret = stream.good();
+  }
+  else
+  {
+    std::ostream cstream(buf);
+    _write_chunk(cstream, data, aligner, format);
+    ret = cstream.good() && buf->finish();
+    delete buf;
+  }
+  stream.close();
+  return ret && !stream.fail();
 }
 
-std::string ztd::filedat::strval(std::string const& aligner) const
+bool ztd::filedat::export_file(std::string const& path, std::string const& aligner, compressionEnum compression) const
 {
-  if(m_dataChunk == nullptr)
-    return "";
-  else
-    return m_dataChunk->strval(0, aligner);
+  return _write_file(path == "" ? m_filePath : path, m_dataChunk, aligner, compression, m_format);
 }
 
-void ztd::filedat::generateChunk()
+// write to temporary file, sync it to disk, then replace destination
+static bool _write_file_atomic(std::string const& path, ztd::chunkdat const* data, std::string const& aligner, ztd::filedat::compressionEnum compression, ztd::filedat::formatEnum format)
 {
-  try
+  static std::atomic<unsigned int> count(0);
+  std::string tmp = path + ".tmp" + std::to_string(getpid()) + '.' + std::to_string(count++);
+  if(!_write_file(tmp, data, aligner, compression, format))
   {
-    if(m_dataChunk != nullptr)
-      delete m_dataChunk;
-    m_data = this->removeComments(m_data);
-    m_dataChunk = new ztd::chunkdat(m_data, 0, nullptr);
+    unlink(tmp.c_str());
+    return false;
   }
-  catch(ztd::format_error& e)
+  int fd = open(tmp.c_str(), O_RDONLY);
+  if(fd < 0 || fsync(fd) != 0 || rename(tmp.c_str(), path.c_str()) != 0)
   {
-    m_dataChunk = nullptr;
-    throw ztd::format_error(e.what(), m_filePath, m_data, e.where());
+    if(fd >= 0)
+      close(fd);
+    unlink(tmp.c_str());
+    return false;
+  }
+  close(fd);
+  // sync directory entry
+  size_t pos = path.rfind('/');
+  std::string dir = pos == std::string::npos ? "." : pos == 0 ? "/" : path.substr(0, pos);
+  fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+  if(fd >= 0)
+  {
+    fsync(fd);
+    close(fd);
   }
+  return true;
 }
 
-std::pair<std::string, size_t> _skip(const std::string& str)
+ztd::file_writer::file_writer()
 {
-  size_t i=0;
+  m_stop=false;
+  m_writing=false;
+  m_errors=0;
+  m_thread = std::thread(ztd::file_writer::run, this);
+}
 
-  //skip to val start
-  while( i < str.size() )
+ztd::file_writer::~file_writer()
+{
   {
-    // start of value
-    if(ztd::filedat::isRead(str[i]))
-      break;
-    i++;
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_stop=true;
   }
-  std::string ret;
-  if(i < str.size())
-    ret = str.substr(i);
-  else
+  m_cv.notify_all();
+  m_thread.join();
+}
+
+void ztd::file_writer::export_async(ztd::chunk_snapshot data, std::string const& path, std::string const& aligner, ztd::filedat::compressionEnum compression, ztd::filedat::formatEnum format)
+{
   {
-    i=str.size();
-    ret="";
+    std::lock_guard<std::mutex> lck(m_mtx);
+    // replaces any pending export of same file
+    m_pending[path] = { data, aligner, compression, format };
   }
-  return std::make_pair(ret, i);
+  m_cv.notify_all();
 }
 
-
-// value, rest, start of rest, start of value, delim found
-static std::tuple<std::string, std::string, int, int, bool> _getstrval(const std::string& str, const char delim=0, const char altdelim=0)
+void ztd::file_writer::export_async(ztd::chunkdat const& data, std::string const& path, std::string const& aligner, ztd::filedat::compressionEnum compression, ztd::filedat::formatEnum format)
 {
-  std::string val;
+  this->export_async(std::make_shared<const ztd::chunkdat>(data), path, aligner, compression, format);
+}
 
-  //skip to start of val
-  size_t i = _skip(str).second;
-  int st = i;
-  bool delim_found=false;
+void ztd::file_writer::export_async(ztd::filedat const& file, std::string const& path, std::string const& aligner, ztd::filedat::compressionEnum compression)
+{
+  this->export_async(file.data(), path == "" ? file.filePath() : path, aligner, compression, file.format());
+}
 
-  // no value
-  if(i >= str.size())
-    return std::make_tuple("","",0,0,false);
+void ztd::file_writer::flush()
+{
+  std::unique_lock<std::mutex> lck(m_mtx);
+  while(m_pending.size() > 0 || m_writing)
+    m_cv.wait(lck);
+}
 
-  while(i < str.size())
+void ztd::file_writer::run(ztd::file_writer* w)
+{
+  std::unique_lock<std::mutex> lck(w->m_mtx);
+  while(true)
   {
-    if( str[i] == '"') // double quotes
+    while(w->m_pending.size() <= 0 && !w->m_stop)
+      w->m_cv.wait(lck);
+    if(w->m_pending.size() <= 0) // stopped and nothing left
+      break;
+
+    auto it = w->m_pending.begin();
+    std::string path = it->first;
+    ztd::file_writer::job job = it->second;
+    w->m_pending.erase(it);
+    w->m_writing=true;
+
+    lck.unlock();
+    bool ok = _write_file_atomic(path, job.data.get(), job.aligner, job.compression, job.format);
+    lck.lock();
+
+    if(!ok)
+      w->m_errors++;
+    w->m_writing=false;
+    w->m_cv.notify_all();
+  }
+}
+
+void ztd::filedat::write(std::ostream& stream, std::string const& aligner) const
+{
+  _write_chunk(stream, m_dataChunk, aligner, m_format);
+}
+
+ztd::chunk_stats ztd::filedat::stats() const
+{
+  ztd::chunk_stats ret;
+  if(m_dataChunk != nullptr)
+    ret = m_dataChunk->memory_usage();
+  ret.source_bytes = _string_heap(m_data);
+  return ret;
+}
+
+ztd::line_index const& ztd::filedat::lines() const
+{
+  if(!m_lines_valid)
+  {
+    m_lines.set(m_data.c_str(), m_data.size());
+    m_lines_valid=true;
+  }
+  return m_lines;
+}
+
+std::string ztd::filedat::strval(std::string const& aligner) const
+{
+  if(m_dataChunk == nullptr)
+    return "";
+  else if(m_format == ztd::filedat::json)
+    return m_dataChunk->json(0, aligner);
+  else
+    return m_dataChunk->strval(0, aligner);
+}
+
+void ztd::filedat::generateChunk()
+{
+  try
+  {
+    if(m_dataChunk != nullptr)
+      delete m_dataChunk;
+    m_dataChunk = nullptr;
+    if(m_format == ztd::filedat::zfd)
+      m_data = this->removeComments(m_data);
+    m_lines_valid=false;
+    size_t bad = ztd::utf8_validate(m_data);
+    if(bad != m_data.size())
+      throw ztd::format_error("Invalid UTF-8", "", m_data, bad);
+    m_dataChunk = new (m_resource) ztd::chunkdat(m_resource);
+    if(m_format == ztd::filedat::json)
+      m_dataChunk->set_json(m_data);
+    else
     {
-      uint32_t j=i;
-      i++;
-      while(i < str.size() && str[i]!='"') // until end of quote
-      {
-        if(i+1 < str.size() && str[i] == '\\' && str[i+1] == '"') //escaped quote
-          i++; //ignore backslash
+      m_dataChunk->set(m_data, 0, nullptr, m_lazy);
+      if(m_lazy)
+        m_dataChunk->set_origin(m_filePath);
+    }
+  }
+  catch(ztd::format_error& e)
+  {
+    if(m_dataChunk != nullptr)
+      delete m_dataChunk;
+    m_dataChunk = nullptr;
+    throw ztd::format_error(e.what(), m_filePath, m_data, e.where());
+  }
+}
 
-        val.push_back(str[i++]); // add char and increment
-      }
-      if(i >= str.size()) // quote didn't end
-        throw ztd::format_error("Double quote doesn't close", "", str, j);
-      i++;
+std::pair<std::string, size_t> _skip(const std::string& str)
+{
+  size_t i=0;
+
+  //skip to val start
+  while( i < str.size() )
+  {
+    // start of value
+    if(ztd::filedat::isRead(str[i]))
+      break;
+    i++;
+  }
+  std::string ret;
+  if(i < str.size())
+    ret = str.substr(i);
+  else
+  {
+    i=str.size();
+    ret="";
+  }
+  return std::make_pair(ret, i);
+}
+
+
+// value, rest, start of rest, start of value, delim found
+static std::tuple<std::string, std::string, int, int, bool> _getstrval(const std::string& str, const char delim=0, const char altdelim=0)
+{
+  std::string val;
+
+  //skip to start of val
+  size_t i = _skip(str).second;
+  int st = i;
+  bool delim_found=false;
+
+  // no value
+  if(i >= str.size())
+    return std::make_tuple("","",0,0,false);
+
+  while(i < str.size())
+  {
+    if( str[i] == '"') // double quotes
+    {
+      size_t e = _unescape(val, str, i+1, '"');
+      if(e == std::string::npos) // quote didn't end
+        throw ztd::format_error("Double quote doesn't close", "", str, i);
+      i = e+1;
     }
     else if( str[i] == '\'') // single quotes
     {
-      uint32_t j=i;
-      i++;
-      while(i < str.size() && str[i]!='\'') // until end of quote
-      {
-        if(i+1 < str.size() && str[i] == '\\' && str[i+1] == '\'') //escaped quote
-          i++; //ignore backslash
-
-        val += str[i++]; // add char
-      }
-      if(i >= str.size()) // quote didn't end
-        throw ztd::format_error("Single quote doesn't close", "", str, j);
-      i++;
+      size_t e = _unescape(val, str, i+1, '\'');
+      if(e == std::string::npos) // quote didn't end
+        throw ztd::format_error("Single quote doesn't close", "", str, i);
+      i = e+1;
     }
     if(str[i] == '{') // {} map
     {
@@ -314,31 +930,13 @@ static std::tuple<std::string, std::string, int, int, bool> _getstrval(const std
           counter--;
         else if(str[i] == '{')
           counter++;
-        else if( str[i] == '"') // double quotes
-        {
-          uint32_t k=i;
-          val += str[i++];
-          while(i < str.size() && str[i]!='"') // until end of quote
-          {
-            if(i+1 < str.size() && str[i] == '\\' && str[i+1] == '"') //escaped quote
-              val += str[i++];
-            val += str[i++];
-          }
-          if(i >= str.size()) // quote didn't end
-            throw ztd::format_error("Double quote does not close", "", str, k);
-        }
-        else if( str[i] == '\'') // single quotes
+        else if( str[i] == '"' || str[i] == '\'') // quotes: copy as is
         {
-          uint32_t k=i;
-          val += str[i++];
-          while(i < str.size() && str[i]!='\'') // until end of quote
-          {
-            if(i+1 < str.size() && str[i] == '\\' && str[i+1] == '\'') //escaped quote
-              val += str[i++];
-            val += str[i++];
-          }
-          if(i >= str.size()) // quote didn't end
-            throw ztd::format_error("Single quote does not close", "", str, k);
+          size_t e = _quote_end(str, i+1, str[i]);
+          if(e == std::string::npos) // quote didn't end
+            throw ztd::format_error(str[i] == '"' ? "Double quote does not close" : "Single quote does not close", "", str, i);
+          val.append(str, i, e-i);
+          i = e;
         }
         val += str[i++];
       }
@@ -359,31 +957,13 @@ static std::tuple<std::string, std::string, int, int, bool> _getstrval(const std
           counter--;
         else if(str[i] == ']')
           counter++;
-        else if( str[i] == '"') // double quotes
+        else if( str[i] == '"' || str[i] == '\'') // quotes: copy as is
         {
-          uint32_t k=i;
-          val += str[i++];
-          while(i < str.size() && str[i]!='"') // until end of quote
-          {
-            if(i+1 < str.size() && str[i] == '\\' && str[i+1] == '"') //escaped quote
-              val += str[i++];
-            val += str[i++];
-          }
-          if(i >= str.size()) // quote didn't end
-            throw ztd::format_error("Double quote does not close", "", str, k);
-        }
-        else if( str[i] == '\'') // single quotes
-        {
-          uint32_t k=i;
-          val += str[i++];
-          while(i < str.size() && str[i]!='\'') // until end of quote
-          {
-            if(i+1 < str.size() && str[i] == '\\' && str[i+1] == '\'') //escaped quote
-              val += str[i++];
-            val += str[i++];
-          }
-          if(i >= str.size()) // quote didn't end
-            throw ztd::format_error("Single quote does not close", "", str, k);
+          size_t e = _quote_end(str, i+1, str[i]);
+          if(e == std::string::npos) // quote didn't end
+            throw ztd::format_error(str[i] == '"' ? "Double quote does not close" : "Single quote does not close", "", str, i);
+          val.append(str, i, e-i);
+          i = e;
         }
         val += str[i++];
       }
@@ -398,7 +978,7 @@ static std::tuple<std::string, std::string, int, int, bool> _getstrval(const std
       std::string tval="";
       if(delim == 0) // delim=0: stop at non read
         break;
-      while(!ztd::filedat::isRead(str[i]) && !(str[i] == delim || str[i] == altdelim) ) // until read or delim
+      while(i < str.size() && !ztd::filedat::isRead(str[i]) && !(str[i] == delim || str[i] == altdelim) ) // until read or delim
         tval += str[i++];
       if(str[i] == delim || str[i] == altdelim) // delim: stop
       {
@@ -491,12 +1071,25 @@ static std::tuple<std::string, std::string, std::string, int, int, int> _getkeyv
 
 }
 
-void ztd::chunkdat::set(const std::string& in, int offset, ztd::filedat* parent)
+void ztd::chunkdat::set(const std::string& in, int offset, ztd::filedat* parent, bool lazy)
 {
   this->clear();
   this->m_parent=parent;
   this->m_offset=offset;
 
+  // strings are taken as is: subchunk values are already unescaped
+  size_t first=0;
+  while(first < in.size() && !ztd::filedat::isRead(in[first]))
+    first++;
+  if(first >= in.size() || (in[first] != '{' && in[first] != '[') )
+  {
+    ztd::chunk_string* cv = new (m_resource) ztd::chunk_string(m_resource);
+    m_achunk=cv;
+    if(first < in.size()) // not empty
+      cv->val = in;
+    return;
+  }
+
   // isolate value
   auto tup = _getstrval(in); // any exception here is caught upwards
   std::string str = std::get<0>(tup);
@@ -504,13 +1097,6 @@ void ztd::chunkdat::set(const std::string& in, int offset, ztd::filedat* parent)
   int i = std::get<2>(tup);
   int j = std::get<3>(tup);
 
-  if(str == "") //empty: make an empty strval
-  {
-    ztd::chunk_string* cv = new ztd::chunk_string();
-    m_achunk=cv;
-    cv->val = "";
-    return;
-  }
   if ( str[0] == '{') // map
   {
     auto p = _skip(rest);
@@ -522,7 +1108,7 @@ void ztd::chunkdat::set(const std::string& in, int offset, ztd::filedat* parent)
     str.pop_back(); // remove last char '}'
 
     // create chunk
-    ztd::chunk_map* tch = new ztd::chunk_map();
+    ztd::chunk_map* tch = new (m_resource) ztd::chunk_map(m_resource);
     m_achunk = tch;
 
     if(_skip(str).first == "") // empty map
@@ -553,8 +1139,8 @@ void ztd::chunkdat::set(const std::string& in, int offset, ztd::filedat* parent)
       {
         try // insert value
         {
-          ztd::chunkdat* chk = new ztd::chunkdat(value, offset + valstart, m_parent);
-          if(!tch->values.insert( std::make_pair(key, chk ) ).second) // failed to insert
+          ztd::chunkdat* chk = this->new_subchunk(std::move(value), offset + valstart, lazy);
+          if(!tch->values.emplace(key, chk).second) // failed to insert
           {
             delete chk;
             throw ztd::format_error("Key '" + key + "' already present", "", in, keystart );
@@ -579,7 +1165,7 @@ void ztd::chunkdat::set(const std::string& in, int offset, ztd::filedat* parent)
     str.pop_back(); // remove last char ']'
 
     // create chunk
-    ztd::chunk_list* tch = new ztd::chunk_list();
+    ztd::chunk_list* tch = new (m_resource) ztd::chunk_list(m_resource);
     m_achunk = tch;
 
     if(_skip(str).first == "") // empty list
@@ -603,7 +1189,7 @@ void ztd::chunkdat::set(const std::string& in, int offset, ztd::filedat* parent)
       }
       try
       {
-        tch->list.push_back(new ztd::chunkdat(value, offset + valstart, m_parent) );
+        tch->list.push_back(this->new_subchunk(std::move(value), offset + valstart, lazy));
       }
       catch(ztd::format_error& e)
       {
@@ -612,50 +1198,235 @@ void ztd::chunkdat::set(const std::string& in, int offset, ztd::filedat* parent)
     }
     while(str != "");
   }
+}
+
+ztd::chunkdat* ztd::chunkdat::new_subchunk(std::string&& in, int offset, bool lazy)
+{
+  ztd::chunkdat* ret = new (m_resource) ztd::chunkdat(m_resource);
+  if(lazy && in.size() > 0 && (in[0] == '{' || in[0] == '[') )
+  {
+    ret->m_offset = offset;
+    ret->m_parent = m_parent;
+    ret->m_lazy = new (m_resource) lazy_data(in, m_resource);
+  }
   else
   {
-    ztd::chunk_string* cv = new ztd::chunk_string();
-    m_achunk=cv;
-    cv->val = in;
+    try
+    {
+      ret->set(in, offset, m_parent);
+    }
+    catch(...)
+    {
+      delete ret;
+      throw;
+    }
+  }
+  // set after parsing: modifications during parse don't need to go up
+  ret->m_upper = this;
+  return ret;
+}
+
+void ztd::chunkdat::materialize() const
+{
+  ztd::chunkdat tmp(m_resource);
+  try
+  {
+    tmp.set(std::string(m_lazy->data), m_offset, m_parent, true);
+  }
+  catch(ztd::format_error& e)
+  {
+    throw ztd::format_error(e.what(), std::string(m_lazy->origin), std::string(m_lazy->data), e.where(), m_offset);
+  }
+  if(m_lazy->origin != "")
+    tmp.set_origin(std::string(m_lazy->origin));
+  delete m_lazy;
+  m_lazy=nullptr;
+  m_achunk = tmp.m_achunk;
+  tmp.m_achunk = nullptr;
+  const_cast<ztd::chunkdat*>(this)->adopt_subchunks();
+}
+
+// fields of list indexes, kept when the list is replaced
+static std::vector<std::string> _index_fields(ztd::chunk_abstract* chunk)
+{
+  std::vector<std::string> ret;
+  if(chunk != nullptr && chunk->type() == ztd::chunk_abstract::list)
+  {
+    for(auto& it : dynamic_cast<ztd::chunk_list*>(chunk)->indexes)
+      ret.push_back(it.first);
   }
+  return ret;
+}
+
+void ztd::chunkdat::restore_indexes(std::vector<std::string> const& fields)
+{
+  if(fields.size() == 0 || this->type() != ztd::chunk_abstract::list)
+    return;
+  for(auto& it : fields)
+    this->build_index(it);
 }
 
 void ztd::chunkdat::set(ztd::chunkdat const& in)
 {
+  std::vector<std::string> fields = _index_fields(m_achunk);
   // reset everything
   this->clear();
   // trace info
   m_offset=in.m_offset;
   m_parent=in.m_parent;
 
+  if(in.m_lazy != nullptr) // unparsed: copy data
+  {
+    m_lazy = new (m_resource) lazy_data(*in.m_lazy, m_resource);
+  }
   // case copy
-  if(in.type()==ztd::chunk_abstract::map) //map
+  else if(in.type()==ztd::chunk_abstract::map) //map
   {
     ztd::chunk_map* cc = dynamic_cast<chunk_map*>(in.getp());
-    ztd::chunk_map* tch = new ztd::chunk_map();
-    for(auto it : cc->values)
+    ztd::chunk_map* tch = new (m_resource) ztd::chunk_map(m_resource);
+    for(auto& it : cc->values)
     {
-      tch->values.insert( std::make_pair(it.first, it.second->pcopy()) );
+      ztd::chunkdat* chk = new (m_resource) ztd::chunkdat(*it.second, m_resource);
+      chk->m_upper = this;
+      tch->values.emplace(it.first, chk);
     }
     m_achunk=tch;
   }
   else if(in.type()==ztd::chunk_abstract::list) //list
   {
     ztd::chunk_list* cc = dynamic_cast<chunk_list*>(in.getp());
-    ztd::chunk_list* tch = new ztd::chunk_list();
+    ztd::chunk_list* tch = new (m_resource) ztd::chunk_list(m_resource);
+    tch->list.reserve(cc->list.size());
     for(auto it : cc->list)
     {
-      tch->list.push_back(it->pcopy());
+      tch->list.push_back(new (m_resource) ztd::chunkdat(*it, m_resource));
+      tch->list.back()->m_upper = this;
     }
     m_achunk=tch;
   }
   else if(in.type()==ztd::chunk_abstract::string) //string
   {
     ztd::chunk_string* cc = dynamic_cast<chunk_string*>(in.getp());
-    ztd::chunk_string* tch = new ztd::chunk_string();
-    tch->val = std::string(cc->val);
+    ztd::chunk_string* tch = new (m_resource) ztd::chunk_string(m_resource);
+    tch->val = cc->val;
     m_achunk = tch;
   }
+  this->restore_indexes(fields);
+}
+
+void ztd::chunkdat::set(ztd::chunkdat&& in)
+{
+  if(&in == this)
+    return;
+  if(*in.m_resource != *m_resource) // different resource: copy
+  {
+    // copy first: input can be a subchunk
+    ztd::chunkdat tmp(in, m_resource);
+    in.clear();
+    this->set(std::move(tmp));
+    return;
+  }
+  // take data before deleting current: input can be a subchunk
+  ztd::chunk_abstract* old = m_achunk;
+  lazy_data* oldlazy = m_lazy;
+  std::vector<std::string> fields = _index_fields(old);
+  m_achunk = in.m_achunk;
+  m_lazy = in.m_lazy;
+  in.m_achunk = nullptr;
+  in.m_lazy = nullptr;
+  in.invalidate_hash();
+  // trace info
+  m_offset=in.m_offset;
+  m_parent=in.m_parent;
+
+  this->adopt_subchunks();
+  this->invalidate_hash();
+  if(old != nullptr)
+    delete old;
+  if(oldlazy != nullptr)
+    delete oldlazy;
+  this->restore_indexes(fields);
+}
+
+void ztd::chunkdat::set(ztd::zfd_view const& in)
+{
+  this->clear();
+  m_offset=0;
+  m_parent=nullptr;
+  // build directly: data is already parsed
+  if(in.type()==ztd::chunk_abstract::map)
+  {
+    ztd::chunk_map* tch = new (m_resource) ztd::chunk_map(m_resource);
+    m_achunk=tch;
+    for(size_t i=0 ; i<in.size() ; i++)
+    {
+      ztd::zfd_view sub = in.at(i);
+      ztd::chunkdat* chk = new (m_resource) ztd::chunkdat(m_resource);
+      chk->set(sub);
+      chk->m_upper = this;
+      tch->values.emplace_hint(tch->values.end(), sub.key(), chk); // sorted keys
+    }
+  }
+  else if(in.type()==ztd::chunk_abstract::list)
+  {
+    ztd::chunk_list* tch = new (m_resource) ztd::chunk_list(m_resource);
+    m_achunk=tch;
+    tch->list.reserve(in.size());
+    for(size_t i=0 ; i<in.size() ; i++)
+    {
+      ztd::chunkdat* chk = new (m_resource) ztd::chunkdat(m_resource);
+      tch->list.push_back(chk);
+      chk->set(in.at(i));
+      chk->m_upper = this;
+    }
+  }
+  else if(in.type()==ztd::chunk_abstract::string)
+  {
+    ztd::chunk_string* tch = new (m_resource) ztd::chunk_string(m_resource);
+    m_achunk=tch;
+    tch->val = in.str();
+  }
+}
+
+void ztd::_zfd::parse_error(const char* message)
+{
+  throw ztd::format_error(message, "", "", -1);
+}
+
+void ztd::chunkdat::set_origin(std::string const& origin)
+{
+  // only parsed chunks are walked: lazy subchunks are below parsed ones
+  if(m_lazy != nullptr)
+    m_lazy->origin = origin;
+  else if(m_achunk == nullptr)
+    return;
+  else if(m_achunk->type()==ztd::chunk_abstract::map)
+  {
+    for(auto& it : dynamic_cast<chunk_map*>(m_achunk)->values)
+      it.second->set_origin(origin);
+  }
+  else if(m_achunk->type()==ztd::chunk_abstract::list)
+  {
+    for(auto it : dynamic_cast<chunk_list*>(m_achunk)->list)
+      it->set_origin(origin);
+  }
+}
+
+void ztd::chunkdat::adopt_subchunks()
+{
+  // type of m_achunk directly: unparsed chunks stay unparsed
+  if(m_achunk == nullptr)
+    return;
+  if(m_achunk->type()==ztd::chunk_abstract::map)
+  {
+    for(auto it : dynamic_cast<chunk_map*>(m_achunk)->values)
+      it.second->m_upper = this;
+  }
+  else if(m_achunk->type()==ztd::chunk_abstract::list)
+  {
+    for(auto it : dynamic_cast<chunk_list*>(m_achunk)->list)
+      it->m_upper = this;
+  }
 }
 
 void ztd::chunkdat::addToMap(std::string const& name, chunkdat const& val)
@@ -663,18 +1434,23 @@ void ztd::chunkdat::addToMap(std::string const& name, chunkdat const& val)
   if(this->type()==ztd::chunk_abstract::map)
   {
     ztd::chunk_map* cp = dynamic_cast<chunk_map*>(m_achunk);
-    ztd::chunkdat* chk = new ztd::chunkdat(val);
-    if( !cp->values.insert( std::make_pair(name,chk) ).second )
+    ztd::chunkdat* chk = new (m_resource) ztd::chunkdat(val, m_resource);
+    chk->m_upper = this;
+    if( !cp->values.emplace(name, chk).second )
     {
       delete chk;
       throw ztd::format_error("Key '" + name + "' already present", "", this->strval(), -1);
     }
+    this->invalidate_hash();
   }
   else if(this->type() == ztd::chunk_abstract::none)
   {
-    ztd::chunk_map* cp = new ztd::chunk_map();
+    ztd::chunk_map* cp = new (m_resource) ztd::chunk_map(m_resource);
     m_achunk=cp;
-    cp->values.insert(std::make_pair(name , new ztd::chunkdat(val)));
+    ztd::chunkdat* chk = new (m_resource) ztd::chunkdat(val, m_resource);
+    chk->m_upper = this;
+    cp->values.emplace(name, chk);
+    this->invalidate_hash();
   }
   else
   {
@@ -693,13 +1469,18 @@ void ztd::chunkdat::addToList(chunkdat const& val)
   if(this->type()==ztd::chunk_abstract::list)
   {
     ztd::chunk_list* lp = dynamic_cast<chunk_list*>(m_achunk);
-    lp->list.push_back(new ztd::chunkdat(val));
+    lp->list.push_back(new (m_resource) ztd::chunkdat(val, m_resource));
+    lp->list.back()->m_upper = this;
+    lp->index_add(lp->list.back());
+    this->invalidate_hash();
   }
   else if(this->type() == ztd::chunk_abstract::none)
   {
-    ztd::chunk_list* lp = new ztd::chunk_list();
+    ztd::chunk_list* lp = new (m_resource) ztd::chunk_list(m_resource);
     m_achunk=lp;
-    lp->list.push_back(new ztd::chunkdat(val));
+    lp->list.push_back(new (m_resource) ztd::chunkdat(val, m_resource));
+    lp->list.back()->m_upper = this;
+    this->invalidate_hash();
   }
   else
   {
@@ -722,9 +1503,9 @@ void ztd::chunkdat::concatenate(chunkdat const& chk)
   else if(this->type()==ztd::chunk_abstract::map && chk.type()==ztd::chunk_abstract::map) //map
   {
     ztd::chunk_map* cc = dynamic_cast<chunk_map*>(chk.getp());
-    for(auto it : cc->values)
+    for(auto& it : cc->values)
     {
-      this->add(it.first, *it.second);
+      this->add(std::string(it.first), *it.second);
     }
   }
   else if(this->type()==ztd::chunk_abstract::list && chk.type()==ztd::chunk_abstract::list) //list
@@ -740,6 +1521,7 @@ void ztd::chunkdat::concatenate(chunkdat const& chk)
     ztd::chunk_string* ci = dynamic_cast<chunk_string*>(chk.getp());
     ztd::chunk_string* cc = dynamic_cast<chunk_string*>(m_achunk);
     cc->val += ci->val;
+    this->invalidate_hash();
   }
   else
   {
@@ -758,12 +1540,12 @@ void ztd::chunkdat::merge(chunkdat const& chk, bool overwrite)
   {
     ztd::chunk_map* ci = dynamic_cast<chunk_map*>(chk.getp());
     ztd::chunk_map* cc = dynamic_cast<chunk_map*>(m_achunk);
-    for(auto it: ci->values) // iterate keys
+    for(auto& it: ci->values) // iterate keys
     {
       auto fi = cc->values.find(it.first);
       if(fi == cc->values.end()) // new key
       {
-        this->addToMap(it.first, *it.second);
+        this->addToMap(std::string(it.first), *it.second);
       }
       else // key already present
       {
@@ -784,7 +1566,10 @@ void ztd::chunkdat::merge(chunkdat const& chk, bool overwrite)
   {
     ztd::chunk_string* cc = dynamic_cast<chunk_string*>(m_achunk);
     if(overwrite)
+    {
       cc->val = chk.str();
+      this->invalidate_hash();
+    }
     else
       throw ztd::format_error("Cannot merge string chunks", "", "", -1);
   }
@@ -797,19 +1582,90 @@ void ztd::chunkdat::merge(chunkdat const& chk, bool overwrite)
   }
 }
 
+void ztd::chunkdat::merge(chunkdat&& chk, bool overwrite)
+{
+  if(*chk.m_resource != *m_resource) // different resource: subchunks can't be taken
+  {
+    this->merge(static_cast<chunkdat const&>(chk), overwrite);
+    return;
+  }
+  if(this->type() == ztd::chunk_abstract::none) //nothing: move
+  {
+    this->set(std::move(chk));
+  }
+  else if(this->type()==ztd::chunk_abstract::map && chk.type()==ztd::chunk_abstract::map) //map
+  {
+    ztd::chunk_map* ci = dynamic_cast<chunk_map*>(chk.getp());
+    ztd::chunk_map* cc = dynamic_cast<chunk_map*>(m_achunk);
+    auto it = ci->values.begin();
+    while(it != ci->values.end()) // iterate keys
+    {
+      auto fi = cc->values.find(it->first);
+      if(fi == cc->values.end()) // new key: take subchunk
+      {
+        it->second->m_upper = this;
+        cc->values.insert(*it);
+        it = ci->values.erase(it);
+      }
+      else // key already present
+      {
+        fi->second->merge(std::move(*it->second), overwrite); // merge subchunks
+        it++;
+      }
+    }
+    chk.invalidate_hash();
+    this->invalidate_hash();
+  }
+  else if(this->type()==ztd::chunk_abstract::list && chk.type()==ztd::chunk_abstract::list) //list
+  {
+    ztd::chunk_list* ci = dynamic_cast<chunk_list*>(chk.getp());
+    ztd::chunk_list* cc = dynamic_cast<chunk_list*>(m_achunk);
+    for(auto it : ci->list)
+    {
+      it->m_upper = this;
+      cc->list.push_back(it);
+      cc->index_add(it);
+    }
+    ci->list.clear();
+    for(auto& it : ci->indexes)
+      it.second = ztd::chunk_list::index();
+    chk.invalidate_hash();
+    this->invalidate_hash();
+  }
+  else if(this->type()==ztd::chunk_abstract::string && chk.type()==ztd::chunk_abstract::string) //string
+  {
+    ztd::chunk_string* cc = dynamic_cast<chunk_string*>(m_achunk);
+    if(overwrite)
+    {
+      cc->val = std::move(dynamic_cast<chunk_string*>(chk.getp())->val);
+      chk.invalidate_hash();
+      this->invalidate_hash();
+    }
+    else
+      throw ztd::format_error("Cannot merge string chunks", "", "", -1);
+  }
+  else
+  {
+    if(overwrite)
+      this->set(std::move(chk));
+    else
+      throw ztd::format_error("Cannot merge chunks of different types", "", "", -1);
+  }
+}
 
 void ztd::chunkdat::erase(const std::string& key)
 {
   if(this->type()==ztd::chunk_abstract::map)
   {
     ztd::chunk_map* cp = dynamic_cast<chunk_map*>(m_achunk);
-    auto it = cp->values.find(key);
+    auto it = cp->values.find(std::string_view(key));
     if( it == cp->values.end() )
     {
       throw ztd::format_error("Key '" + key + "' not present", "", this->strval(), -1);
     }
     delete it->second;
     cp->values.erase(it);
+    this->invalidate_hash();
   }
   else
   {
@@ -826,8 +1682,10 @@ void ztd::chunkdat::erase(const unsigned int index)
       throw ztd::format_error("Cannot erase out of bonds: "+std::to_string(index)+" in size "+std::to_string(this->listSize()), "", this->strval(), -1);
     }
     ztd::chunk_list* lp = dynamic_cast<chunk_list*>(m_achunk);
+    lp->index_remove(lp->list[index]);
     delete lp->list[index];
     lp->list.erase(lp->list.begin() + index);
+    this->invalidate_hash();
   }
   else
   {
@@ -845,7 +1703,7 @@ std::vector<ztd::chunkdat*> ztd::chunkdat::getlist()
       throw ztd::format_error("chunkdat isn't a list", "", this->strval(), -1);
   }
   ztd::chunk_list* cl = dynamic_cast<chunk_list*>(m_achunk);
-  return cl->list;
+  return std::vector<ztd::chunkdat*>(cl->list.begin(), cl->list.end());
 }
 std::map<std::string, ztd::chunkdat*> ztd::chunkdat::getmap()
 {
@@ -857,74 +1715,552 @@ std::map<std::string, ztd::chunkdat*> ztd::chunkdat::getmap()
       throw ztd::format_error("chunkdat isn't a map", "", this->strval(), -1);
   }
   ztd::chunk_map* dc = dynamic_cast<chunk_map*>(m_achunk);
-  return dc->values;
+  std::map<std::string, ztd::chunkdat*> ret;
+  for(auto& it : dc->values)
+    ret.emplace_hint(ret.end(), it.first, it.second);
+  return ret;
 }
 
 std::string ztd::chunkdat::strval(unsigned int alignment, std::string const& aligner) const
 {
   if(this->type()==ztd::chunk_abstract::string)
-  {
-    ztd::chunk_string* vp = dynamic_cast<chunk_string*>(m_achunk);
+    return std::string(dynamic_cast<chunk_string*>(m_achunk)->val);
+  std::ostringstream stream;
+  this->write(stream, alignment, aligner);
+  return stream.str();
+}
 
-    return vp->val;
+void ztd::chunkdat::write(std::ostream& stream, unsigned int alignment, std::string const& aligner) const
+{
+  if(this->type()==ztd::chunk_abstract::string)
+  {
+    stream << dynamic_cast<chunk_string*>(m_achunk)->val;
   }
   else if(this->type()==ztd::chunk_abstract::map)
   {
     ztd::chunk_map* cp = dynamic_cast<chunk_map*>(m_achunk);
     if(cp->values.size() <= 0)
-      return "{}";
-    std::string ret="{\n";
-    for(auto it : cp->values)
     {
-      ret += repeatString(aligner,alignment+1);
-      ret += it.first;
-      ret += " = ";
+      stream << "{}";
+      return;
+    }
+    stream << "{\n";
+    for(auto& it : cp->values)
+    {
+      indent(stream, aligner, alignment+1);
+      if(_plain_key(it.first))
+        stream << it.first;
+      else
+      {
+        stream << '"';
+        escape(stream, it.first, '"');
+        stream << '"';
+      }
+      stream << " = ";
       if(it.second!=nullptr)
       {
         if(it.second->type() == ztd::chunk_abstract::string)
         {
-          ret += "\"" + escape(it.second->strval(), '"') + "\"";
+          stream << '"';
+          escape(stream, dynamic_cast<chunk_string*>(it.second->getp())->val, '"');
+          stream << '"';
         }
         else
         {
-          ret += it.second->strval(alignment+1, aligner);
+          it.second->write(stream, alignment+1, aligner);
         }
       }
-      ret += '\n';
+      stream << '\n';
     }
-    ret += repeatString(aligner, alignment);
-    ret += '}';
-    return ret;
+    indent(stream, aligner, alignment);
+    stream << '}';
   }
   else if(this->type()==ztd::chunk_abstract::list)
   {
     ztd::chunk_list* lp = dynamic_cast<chunk_list*>(m_achunk);
     if(lp->list.size() <= 0)
-      return "[]";
-    std::string ret="[\n";
-    for(auto it : lp->list)
     {
-      ret += repeatString(aligner, alignment+1);
-      if(it!=nullptr)
+      stream << "[]";
+      return;
+    }
+    stream << "[\n";
+    for(size_t i=0 ; i<lp->list.size() ; i++)
+    {
+      ztd::chunkdat* it = lp->list[i];
+      indent(stream, aligner, alignment+1);
+      if(it!=nullptr)
       {
         if(it->type() == ztd::chunk_abstract::string)
         {
-          ret += '"' + escape(it->strval(), '"') + '"';
+          stream << '"';
+          escape(stream, dynamic_cast<chunk_string*>(it->getp())->val, '"');
+          stream << '"';
         }
         else
         {
-          ret += it->strval(alignment+1, aligner);
+          it->write(stream, alignment+1, aligner);
         }
       }
-      ret += ",\n";
+      if(i+1 < lp->list.size())
+        stream << ',';
+      stream << '\n';
     }
-    ret.erase(ret.end()-2);
-    ret += repeatString(aligner, alignment);
-    ret += ']';
-    return ret;
+    indent(stream, aligner, alignment);
+    stream << ']';
+  }
+}
+
+// JSON
+
+static void _json_skip(std::string const& in, size_t& i)
+{
+  while(i < in.size() && (in[i] == ' ' || in[i] == '\n' || in[i] == '\t' || in[i] == '\r'))
+    i++;
+}
+
+// value of 4 hex digits at i, -1 if invalid
+static long _json_hex(std::string const& in, size_t i)
+{
+  if(i+4 > in.size())
+    return -1;
+  long ret=0;
+  for(size_t j=i ; j<i+4 ; j++)
+  {
+    char c = in[j];
+    ret <<= 4;
+    if(c >= '0' && c <= '9')
+      ret |= c-'0';
+    else if(c >= 'a' && c <= 'f')
+      ret |= c-'a'+10;
+    else if(c >= 'A' && c <= 'F')
+      ret |= c-'A'+10;
+    else
+      return -1;
+  }
+  return ret;
+}
+
+template <class S>
+static void _utf8_append(S& out, uint32_t cp)
+{
+  if(cp < 0x80)
+    out += (char) cp;
+  else if(cp < 0x800)
+  {
+    out += (char) (0xC0 | (cp >> 6));
+    out += (char) (0x80 | (cp & 0x3F));
+  }
+  else if(cp < 0x10000)
+  {
+    out += (char) (0xE0 | (cp >> 12));
+    out += (char) (0x80 | ((cp >> 6) & 0x3F));
+    out += (char) (0x80 | (cp & 0x3F));
+  }
+  else
+  {
+    out += (char) (0xF0 | (cp >> 18));
+    out += (char) (0x80 | ((cp >> 12) & 0x3F));
+    out += (char) (0x80 | ((cp >> 6) & 0x3F));
+    out += (char) (0x80 | (cp & 0x3F));
+  }
+}
+
+// append content of JSON string starting at i to out. i is set after closing quote
+template <class S>
+static void _json_string(std::string const& in, size_t& i, S& out)
+{
+  size_t start=i++;
+  while(true)
+  {
+    // copy runs of plain chars at once
+    size_t j=i;
+    while(j < in.size() && in[j] != '"' && in[j] != '\\' && (unsigned char) in[j] >= 0x20)
+      j++;
+    out.append(in.data()+i, j-i);
+    i=j;
+    if(i >= in.size())
+      throw ztd::format_error("Double quote doesn't close", "", in, start);
+    if(in[i] == '"')
+    {
+      i++;
+      return;
+    }
+    if(in[i] != '\\')
+      throw ztd::format_error("Control character in string", "", in, i);
+    if(i+1 >= in.size())
+      throw ztd::format_error("Double quote doesn't close", "", in, start);
+    char c = in[i+1];
+    switch(c)
+    {
+      case '"': case '\\': case '/': out += c; break;
+      case 'b': out += '\b'; break;
+      case 'f': out += '\f'; break;
+      case 'n': out += '\n'; break;
+      case 'r': out += '\r'; break;
+      case 't': out += '\t'; break;
+      case 'u':
+      {
+        long cp = _json_hex(in, i+2);
+        if(cp < 0)
+          throw ztd::format_error("Invalid unicode escape", "", in, i);
+        if(cp >= 0xD800 && cp <= 0xDBFF) // surrogate pair
+        {
+          long low = (i+7 < in.size() && in[i+6] == '\\' && in[i+7] == 'u') ? _json_hex(in, i+8) : -1;
+          if(low < 0xDC00 || low > 0xDFFF)
+            throw ztd::format_error("Invalid unicode escape", "", in, i);
+          cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+          i += 6;
+        }
+        else if(cp >= 0xDC00 && cp <= 0xDFFF)
+          throw ztd::format_error("Invalid unicode escape", "", in, i);
+        _utf8_append(out, cp);
+        i += 4;
+        break;
+      }
+      default:
+        throw ztd::format_error("Invalid escape", "", in, i);
+    }
+    i += 2;
+  }
+}
+
+// end of JSON number starting at i, npos if invalid
+static size_t _json_number_end(std::string const& in, size_t i)
+{
+  auto digits = [&in](size_t& j) { size_t st=j; while(j < in.size() && in[j] >= '0' && in[j] <= '9') j++; return j-st; };
+  if(i < in.size() && in[i] == '-')
+    i++;
+  if(i < in.size() && in[i] == '0')
+    i++;
+  else if(digits(i) == 0)
+    return std::string::npos;
+  if(i < in.size() && in[i] == '.')
+  {
+    i++;
+    if(digits(i) == 0)
+      return std::string::npos;
+  }
+  if(i < in.size() && (in[i] == 'e' || in[i] == 'E'))
+  {
+    i++;
+    if(i < in.size() && (in[i] == '+' || in[i] == '-'))
+      i++;
+    if(digits(i) == 0)
+      return std::string::npos;
+  }
+  return i;
+}
+
+void ztd::chunkdat::parse_json(std::string const& in, size_t& i, int offset, unsigned int depth)
+{
+  if(depth > JSON_MAX_DEPTH)
+    throw ztd::format_error("JSON nesting too deep", "", in, i);
+  if(i >= in.size())
+    throw ztd::format_error("Value expected", "", in, i);
+  m_offset = offset + i;
+  if(in[i] == '{') // object
+  {
+    ztd::chunk_map* tch = new (m_resource) ztd::chunk_map(m_resource);
+    m_achunk = tch;
+    i++;
+    _json_skip(in, i);
+    if(i < in.size() && in[i] == '}')
+    {
+      i++;
+      return;
+    }
+    while(true)
+    {
+      if(i >= in.size() || in[i] != '"')
+        throw ztd::format_error("Key expected", "", in, i);
+      size_t keystart=i;
+      std::pmr::string key(m_resource);
+      _json_string(in, i, key);
+      auto ins = tch->values.emplace(std::move(key), nullptr);
+      if(!ins.second)
+        throw ztd::format_error("Key '" + std::string(ins.first->first) + "' already present", "", in, keystart);
+      _json_skip(in, i);
+      if(i >= in.size() || in[i] != ':')
+        throw ztd::format_error("':' expected", "", in, i);
+      i++;
+      _json_skip(in, i);
+      ztd::chunkdat* chk = new (m_resource) ztd::chunkdat(m_resource);
+      ins.first->second = chk;
+      chk->m_parent = m_parent;
+      chk->parse_json(in, i, offset, depth+1);
+      chk->m_upper = this;
+      _json_skip(in, i);
+      if(i < in.size() && in[i] == ',')
+      {
+        i++;
+        _json_skip(in, i);
+      }
+      else if(i < in.size() && in[i] == '}')
+      {
+        i++;
+        return;
+      }
+      else
+        throw ztd::format_error("',' or '}' expected", "", in, i);
+    }
+  }
+  else if(in[i] == '[') // array
+  {
+    ztd::chunk_list* tch = new (m_resource) ztd::chunk_list(m_resource);
+    m_achunk = tch;
+    i++;
+    _json_skip(in, i);
+    if(i < in.size() && in[i] == ']')
+    {
+      i++;
+      return;
+    }
+    while(true)
+    {
+      ztd::chunkdat* chk = new (m_resource) ztd::chunkdat(m_resource);
+      tch->list.push_back(chk);
+      chk->m_parent = m_parent;
+      chk->parse_json(in, i, offset, depth+1);
+      chk->m_upper = this;
+      _json_skip(in, i);
+      if(i < in.size() && in[i] == ',')
+      {
+        i++;
+        _json_skip(in, i);
+      }
+      else if(i < in.size() && in[i] == ']')
+      {
+        i++;
+        return;
+      }
+      else
+        throw ztd::format_error("',' or ']' expected", "", in, i);
+    }
+  }
+  else if(in[i] == '"') // string
+  {
+    ztd::chunk_string* tch = new (m_resource) ztd::chunk_string(m_resource);
+    m_achunk = tch;
+    _json_string(in, i, tch->val);
+  }
+  else if(in.compare(i, 4, "null") == 0) // empty
+  {
+    i += 4;
+  }
+  else if(in.compare(i, 4, "true") == 0 || in.compare(i, 5, "false") == 0) // boolean: as string
+  {
+    size_t n = in[i] == 't' ? 4 : 5;
+    ztd::chunk_string* tch = new (m_resource) ztd::chunk_string(m_resource);
+    m_achunk = tch;
+    tch->val.assign(in, i, n);
+    i += n;
+  }
+  else // number: as string
+  {
+    size_t end = _json_number_end(in, i);
+    if(end == std::string::npos)
+      throw ztd::format_error("Unexpected char", "", in, i);
+    ztd::chunk_string* tch = new (m_resource) ztd::chunk_string(m_resource);
+    m_achunk = tch;
+    tch->val.assign(in, i, end-i);
+    i = end;
+  }
+}
+
+void ztd::chunkdat::set_json(std::string const& in, int offset, ztd::filedat* parent)
+{
+  this->clear();
+  m_parent=parent;
+  try
+  {
+    size_t i=0;
+    _json_skip(in, i);
+    this->parse_json(in, i, offset, 0);
+    _json_skip(in, i);
+    if(i < in.size())
+      throw ztd::format_error("Unexpected char", "", in, i);
+  }
+  catch(...)
+  {
+    this->clear();
+    throw;
+  }
+  m_offset=offset;
+  this->invalidate_hash();
+}
+
+// write str as content of JSON string
+static void _json_escape(std::ostream& stream, std::string_view str)
+{
+  size_t i=0, j=0;
+  for( ; j<str.size() ; j++)
+  {
+    unsigned char c = str[j];
+    if(c >= 0x20 && c != '"' && c != '\\') // plain char
+      continue;
+    stream.write(str.data()+i, j-i);
+    i = j+1;
+    switch(c)
+    {
+      case '"': stream << "\\\""; break;
+      case '\\': stream << "\\\\"; break;
+      case '\b': stream << "\\b"; break;
+      case '\f': stream << "\\f"; break;
+      case '\n': stream << "\\n"; break;
+      case '\r': stream << "\\r"; break;
+      case '\t': stream << "\\t"; break;
+      default:
+      {
+        const char hex[] = "0123456789abcdef";
+        stream << "\\u00" << hex[c >> 4] << hex[c & 0xF];
+      }
+    }
+  }
+  stream.write(str.data()+i, j-i);
+}
+
+std::string ztd::chunkdat::json(unsigned int alignment, std::string const& aligner) const
+{
+  std::ostringstream stream;
+  this->write_json(stream, alignment, aligner);
+  return stream.str();
+}
+
+void ztd::chunkdat::write_json(std::ostream& stream, unsigned int alignment, std::string const& aligner) const
+{
+  bool pretty = aligner != "";
+  if(this->type()==ztd::chunk_abstract::string)
+  {
+    stream << '"';
+    _json_escape(stream, dynamic_cast<chunk_string*>(m_achunk)->val);
+    stream << '"';
+  }
+  else if(this->type()==ztd::chunk_abstract::map)
+  {
+    ztd::chunk_map* cp = dynamic_cast<chunk_map*>(m_achunk);
+    if(cp->values.size() <= 0)
+    {
+      stream << "{}";
+      return;
+    }
+    stream << '{';
+    bool first=true;
+    for(auto& it : cp->values)
+    {
+      if(!first)
+        stream << ',';
+      first=false;
+      if(pretty)
+      {
+        stream << '\n';
+        indent(stream, aligner, alignment+1);
+      }
+      stream << '"';
+      _json_escape(stream, it.first);
+      stream << (pretty ? "\": " : "\":");
+      if(it.second != nullptr)
+        it.second->write_json(stream, alignment+1, aligner);
+      else
+        stream << "null";
+    }
+    if(pretty)
+    {
+      stream << '\n';
+      indent(stream, aligner, alignment);
+    }
+    stream << '}';
+  }
+  else if(this->type()==ztd::chunk_abstract::list)
+  {
+    ztd::chunk_list* lp = dynamic_cast<chunk_list*>(m_achunk);
+    if(lp->list.size() <= 0)
+    {
+      stream << "[]";
+      return;
+    }
+    stream << '[';
+    for(size_t i=0 ; i<lp->list.size() ; i++)
+    {
+      if(i > 0)
+        stream << ',';
+      if(pretty)
+      {
+        stream << '\n';
+        indent(stream, aligner, alignment+1);
+      }
+      if(lp->list[i] != nullptr)
+        lp->list[i]->write_json(stream, alignment+1, aligner);
+      else
+        stream << "null";
+    }
+    if(pretty)
+    {
+      stream << '\n';
+      indent(stream, aligner, alignment);
+    }
+    stream << ']';
+  }
+  else // empty
+  {
+    stream << "null";
+  }
+}
+
+ztd::chunk_stats& ztd::chunk_stats::operator+=(ztd::chunk_stats const& in)
+{
+  strings += in.strings;
+  maps += in.maps;
+  lists += in.lists;
+  empty += in.empty;
+  unparsed += in.unparsed;
+  string_bytes += in.string_bytes;
+  node_bytes += in.node_bytes;
+  container_bytes += in.container_bytes;
+  source_bytes += in.source_bytes;
+  return *this;
+}
+
+ztd::chunk_stats ztd::chunkdat::memory_usage() const
+{
+  ztd::chunk_stats ret;
+  ret.node_bytes += _chunk_header_size + sizeof(ztd::chunkdat);
+  if(m_lazy != nullptr) // don't parse
+  {
+    ret.unparsed++;
+    ret.string_bytes += _chunk_header_size + sizeof(lazy_data) + _string_heap(m_lazy->data) + _string_heap(m_lazy->origin);
+  }
+  else if(this->type()==ztd::chunk_abstract::string)
+  {
+    ztd::chunk_string* cp = dynamic_cast<ztd::chunk_string*>(m_achunk);
+    ret.strings++;
+    ret.node_bytes += _chunk_header_size + sizeof(ztd::chunk_string);
+    ret.string_bytes += _string_heap(cp->val);
+  }
+  else if(this->type()==ztd::chunk_abstract::map)
+  {
+    ztd::chunk_map* cp = dynamic_cast<ztd::chunk_map*>(m_achunk);
+    ret.maps++;
+    ret.node_bytes += _chunk_header_size + sizeof(ztd::chunk_map);
+    // red-black tree node: color and 3 links, then value
+    ret.container_bytes += cp->values.size() * (4*sizeof(void*) + sizeof(decltype(cp->values)::value_type));
+    for(auto& it : cp->values)
+    {
+      ret.string_bytes += _string_heap(it.first);
+      ret += it.second->memory_usage();
+    }
+  }
+  else if(this->type()==ztd::chunk_abstract::list)
+  {
+    ztd::chunk_list* cp = dynamic_cast<ztd::chunk_list*>(m_achunk);
+    ret.lists++;
+    ret.node_bytes += _chunk_header_size + sizeof(ztd::chunk_list);
+    ret.container_bytes += cp->list.capacity() * sizeof(ztd::chunkdat*);
+    for(auto it : cp->list)
+      ret += it->memory_usage();
   }
   else
-  return "";
+    ret.empty++;
+  return ret;
 }
 
 int ztd::chunkdat::listSize() const
@@ -940,7 +2276,7 @@ ztd::chunkdat* ztd::chunkdat::subChunkPtr(std::string const& in) const
   if(this->type()==ztd::chunk_abstract::map)
   {
     ztd::chunk_map* dc = dynamic_cast<chunk_map*>(m_achunk);
-    auto fi = dc->values.find(in);
+    auto fi = dc->values.find(std::string_view(in));
     if(fi == dc->values.end()) //none found
       return nullptr;
     return fi->second;
@@ -976,7 +2312,7 @@ ztd::chunkdat& ztd::chunkdat::subChunkRef(std::string const& in) const
       throw ztd::format_error("chunkdat isn't a map", "", this->strval(), -1);
   }
   ztd::chunk_map* dc = dynamic_cast<chunk_map*>(m_achunk);
-  auto fi = dc->values.find(in);
+  auto fi = dc->values.find(std::string_view(in));
   if(fi == dc->values.end())
   {
     if(m_parent != nullptr)
@@ -1009,32 +2345,82 @@ ztd::chunkdat& ztd::chunkdat::subChunkRef(const unsigned int a) const
 
 ztd::chunkdat::chunkdat()
 {
+  m_resource=ztd::chunk_default_resource();
   m_achunk=nullptr;
   m_parent=nullptr;
   m_offset=0;
+  m_upper=nullptr;
+  m_lazy=nullptr;
+  m_hash_valid=false;
+}
+ztd::chunkdat::chunkdat(std::pmr::memory_resource* resource)
+{
+  m_resource=resource;
+  m_achunk=nullptr;
+  m_parent=nullptr;
+  m_offset=0;
+  m_upper=nullptr;
+  m_lazy=nullptr;
+  m_hash_valid=false;
 }
 ztd::chunkdat::chunkdat(const char* in)
 {
+  m_resource=ztd::chunk_default_resource();
   m_achunk=nullptr;
+  m_upper=nullptr;
+  m_lazy=nullptr;
+  m_hash_valid=false;
   set(in, strlen(in), 0, nullptr);
 }
-ztd::chunkdat::chunkdat(std::string const& in, int offset, filedat* parent)
+ztd::chunkdat::chunkdat(std::string const& in, int offset, filedat* parent, bool lazy)
 {
+  m_resource=ztd::chunk_default_resource();
   m_achunk=nullptr;
-  set(in, offset, parent);
+  m_upper=nullptr;
+  m_lazy=nullptr;
+  m_hash_valid=false;
+  set(in, offset, parent, lazy);
 }
 ztd::chunkdat::chunkdat(const char* in, const int in_size, int offset, filedat* parent)
 {
+  m_resource=ztd::chunk_default_resource();
   m_achunk=nullptr;
+  m_upper=nullptr;
+  m_lazy=nullptr;
+  m_hash_valid=false;
   set(in, in_size, offset, parent);
 }
 ztd::chunkdat::chunkdat(chunkdat const& in)
 {
+  m_resource=ztd::chunk_default_resource();
   m_achunk=nullptr;
+  m_upper=nullptr;
+  m_lazy=nullptr;
+  m_hash_valid=false;
   set(in);
 }
+ztd::chunkdat::chunkdat(chunkdat const& in, std::pmr::memory_resource* resource)
+{
+  m_resource=resource;
+  m_achunk=nullptr;
+  m_upper=nullptr;
+  m_lazy=nullptr;
+  m_hash_valid=false;
+  set(in);
+}
+ztd::chunkdat::chunkdat(chunkdat&& in)
+{
+  m_resource=in.m_resource;
+  m_achunk=nullptr;
+  m_upper=nullptr;
+  m_lazy=nullptr;
+  m_hash_valid=false;
+  set(std::move(in));
+}
 ztd::chunkdat::~chunkdat()
 {
+  // deletion is handled by upper chunk
+  m_upper=nullptr;
   clear();
 }
 
@@ -1043,16 +2429,213 @@ void ztd::chunkdat::clear()
   if(m_achunk!=nullptr)
     delete m_achunk;
   m_achunk=nullptr;
+  if(m_lazy!=nullptr)
+    delete m_lazy;
+  m_lazy=nullptr;
+  this->invalidate_hash();
+}
+
+void ztd::chunkdat::invalidate_hash()
+{
+  m_hash_valid=false;
+  ztd::chunkdat* prev=this;
+  for(ztd::chunkdat* it=m_upper ; it!=nullptr ; prev=it, it=it->m_upper)
+  {
+    it->m_hash_valid=false;
+    // indexed list: the element containing the modification is outdated
+    if(it->m_achunk != nullptr && it->m_achunk->type() == ztd::chunk_abstract::list)
+    {
+      ztd::chunk_list* cl = dynamic_cast<chunk_list*>(it->m_achunk);
+      if(cl->indexes.size() > 0)
+        cl->index_dirty(prev);
+    }
+  }
+}
+
+size_t ztd::chunkdat::hash() const
+{
+  if(m_hash_valid)
+    return m_hash;
+
+  size_t ret = hash_combine(0, this->type());
+  if(this->type()==ztd::chunk_abstract::string)
+  {
+    ztd::chunk_string* cp = dynamic_cast<chunk_string*>(m_achunk);
+    ret = hash_combine(ret, std::hash<std::string_view>()(cp->val));
+  }
+  else if(this->type()==ztd::chunk_abstract::map)
+  {
+    ztd::chunk_map* cp = dynamic_cast<chunk_map*>(m_achunk);
+    for(auto& it : cp->values)
+    {
+      ret = hash_combine(ret, std::hash<std::string_view>()(it.first));
+      ret = hash_combine(ret, it.second->hash());
+    }
+  }
+  else if(this->type()==ztd::chunk_abstract::list)
+  {
+    ztd::chunk_list* cp = dynamic_cast<chunk_list*>(m_achunk);
+    for(auto it : cp->list)
+      ret = hash_combine(ret, it->hash());
+  }
+
+  m_hash=ret;
+  m_hash_valid=true;
+  return ret;
+}
+
+bool ztd::operator==(const ztd::chunkdat& a, const char* b)
+{
+  if(a.type()==ztd::chunk_abstract::string)
+    return dynamic_cast<chunk_string*>(a.getp())->val == b;
+  return a.strval() == b;
+}
+
+bool ztd::operator==(const ztd::chunkdat& a, const ztd::chunkdat& b)
+{
+  if(&a == &b)
+    return true;
+  if(a.type() != b.type() || a.hash() != b.hash())
+    return false;
+
+  if(a.type()==ztd::chunk_abstract::string)
+  {
+    return dynamic_cast<chunk_string*>(a.getp())->val == dynamic_cast<chunk_string*>(b.getp())->val;
+  }
+  else if(a.type()==ztd::chunk_abstract::map)
+  {
+    ztd::chunk_map* ca = dynamic_cast<chunk_map*>(a.getp());
+    ztd::chunk_map* cb = dynamic_cast<chunk_map*>(b.getp());
+    if(ca->values.size() != cb->values.size())
+      return false;
+    for(auto ia=ca->values.begin(), ib=cb->values.begin() ; ia!=ca->values.end() ; ia++, ib++)
+    {
+      if(ia->first != ib->first || !(*ia->second == *ib->second) )
+        return false;
+    }
+  }
+  else if(a.type()==ztd::chunk_abstract::list)
+  {
+    ztd::chunk_list* ca = dynamic_cast<chunk_list*>(a.getp());
+    ztd::chunk_list* cb = dynamic_cast<chunk_list*>(b.getp());
+    if(ca->list.size() != cb->list.size())
+      return false;
+    for(size_t i=0 ; i<ca->list.size() ; i++)
+    {
+      if( !(*ca->list[i] == *cb->list[i]) )
+        return false;
+    }
+  }
+  return true;
 }
 
 ztd::chunk_abstract::typeEnum ztd::chunkdat::type() const
 {
+  if(m_lazy!=nullptr)
+    this->materialize();
   if(m_achunk!=nullptr)
     return m_achunk->type();
   else
     return ztd::chunk_abstract::none;
 }
 
+static std::atomic<ztd::chunk_alloc_hook> alloc_hook(nullptr);
+
+void ztd::set_chunk_alloc_hook(ztd::chunk_alloc_hook hook)
+{
+  alloc_hook.store(hook, std::memory_order_release);
+}
+
+void* ztd::counting_resource::do_allocate(size_t bytes, size_t alignment)
+{
+  void* p = m_upstream->allocate(bytes, alignment);
+  ztd::chunk_alloc_hook hook = alloc_hook.load(std::memory_order_acquire);
+  if(hook != nullptr)
+    hook(bytes, true);
+  return p;
+}
+void ztd::counting_resource::do_deallocate(void* p, size_t bytes, size_t alignment)
+{
+  ztd::chunk_alloc_hook hook = alloc_hook.load(std::memory_order_acquire);
+  if(hook != nullptr)
+    hook(bytes, false);
+  m_upstream->deallocate(p, bytes, alignment);
+}
+bool ztd::counting_resource::do_is_equal(std::pmr::memory_resource const& other) const noexcept
+{
+  if(this == &other)
+    return true;
+  const ztd::counting_resource* cp = dynamic_cast<const ztd::counting_resource*>(&other);
+  return cp != nullptr && *m_upstream == *cp->m_upstream;
+}
+
+std::pmr::memory_resource* ztd::chunk_default_resource()
+{
+  static ztd::counting_resource def;
+  return &def;
+}
+
+static void* _chunk_new(size_t size, std::pmr::memory_resource* resource)
+{
+  void* p = resource->allocate(_chunk_header_size + size, alignof(std::max_align_t));
+  _chunk_header* head = (_chunk_header*) p;
+  head->resource = resource;
+  head->size = size;
+  return (char*) p + _chunk_header_size;
+}
+static void _chunk_delete(void* p)
+{
+  _chunk_header* head = (_chunk_header*) ((char*) p - _chunk_header_size);
+  size_t size = head->size;
+  head->resource->deallocate(head, _chunk_header_size + size, alignof(std::max_align_t));
+}
+
+void* ztd::chunkdat::operator new(size_t size)
+{
+  return _chunk_new(size, ztd::chunk_default_resource());
+}
+void* ztd::chunkdat::operator new(size_t size, std::pmr::memory_resource* resource)
+{
+  return _chunk_new(size, resource);
+}
+void ztd::chunkdat::operator delete(void* p, size_t)
+{
+  _chunk_delete(p);
+}
+void ztd::chunkdat::operator delete(void* p, std::pmr::memory_resource*)
+{
+  _chunk_delete(p);
+}
+void* ztd::chunk_abstract::operator new(size_t size)
+{
+  return _chunk_new(size, ztd::chunk_default_resource());
+}
+void* ztd::chunk_abstract::operator new(size_t size, std::pmr::memory_resource* resource)
+{
+  return _chunk_new(size, resource);
+}
+void ztd::chunk_abstract::operator delete(void* p, size_t)
+{
+  _chunk_delete(p);
+}
+void ztd::chunk_abstract::operator delete(void* p, std::pmr::memory_resource*)
+{
+  _chunk_delete(p);
+}
+
+void* ztd::chunkdat::lazy_data::operator new(size_t size, std::pmr::memory_resource* resource)
+{
+  return _chunk_new(size, resource);
+}
+void ztd::chunkdat::lazy_data::operator delete(void* p)
+{
+  _chunk_delete(p);
+}
+void ztd::chunkdat::lazy_data::operator delete(void* p, std::pmr::memory_resource*)
+{
+  _chunk_delete(p);
+}
+
 ztd::chunk_abstract::chunk_abstract()
 {
   m_type=ztd::chunk_abstract::none;
@@ -1066,7 +2649,7 @@ ztd::chunk_abstract::~chunk_abstract()
 
 }
 
-ztd::chunk_string::chunk_string()
+ztd::chunk_string::chunk_string(std::pmr::memory_resource* resource) : val(resource)
 {
   m_type=ztd::chunk_abstract::string;
 }
@@ -1075,7 +2658,7 @@ ztd::chunk_string::~chunk_string()
 
 }
 
-ztd::chunk_map::chunk_map()
+ztd::chunk_map::chunk_map(std::pmr::memory_resource* resource) : values(resource)
 {
   m_type=ztd::chunk_abstract::map;
 }
@@ -1088,7 +2671,149 @@ ztd::chunk_map::~chunk_map()
   }
 }
 
-ztd::chunk_list::chunk_list()
+// Indexes
+
+static void _index_insert(ztd::chunk_list::index& idx, std::string const& field, ztd::chunkdat* elem)
+{
+  ztd::chunkdat* val = elem->subChunkPtr(field);
+  if(val == nullptr || val->type() != ztd::chunk_abstract::string)
+    return;
+  std::string key(dynamic_cast<ztd::chunk_string*>(val->getp())->val);
+  idx.values.insert(std::make_pair(key, elem));
+  idx.keys[elem] = key;
+}
+
+static void _index_erase(ztd::chunk_list::index& idx, ztd::chunkdat* elem)
+{
+  auto fi = idx.keys.find(elem);
+  if(fi == idx.keys.end())
+    return;
+  auto range = idx.values.equal_range(fi->second);
+  for(auto it=range.first ; it!=range.second ; it++)
+  {
+    if(it->second == elem)
+    {
+      idx.values.erase(it);
+      break;
+    }
+  }
+  idx.keys.erase(fi);
+}
+
+void ztd::chunk_list::index_add(ztd::chunkdat* elem)
+{
+  for(auto& it : indexes)
+  {
+    if(!it.second.rebuild)
+      _index_insert(it.second, it.first, elem);
+  }
+}
+
+void ztd::chunk_list::index_remove(ztd::chunkdat* elem)
+{
+  for(auto& it : indexes)
+  {
+    _index_erase(it.second, elem);
+    it.second.dirty.erase(elem);
+  }
+}
+
+void ztd::chunk_list::index_dirty(ztd::chunkdat* elem)
+{
+  for(auto& it : indexes)
+  {
+    if(!it.second.rebuild)
+      it.second.dirty.insert(elem);
+  }
+}
+
+void ztd::chunk_list::index_update(std::string const& field, ztd::chunk_list::index& idx)
+{
+  if(idx.rebuild)
+  {
+    idx = ztd::chunk_list::index();
+    idx.values.reserve(list.size());
+    for(auto it : list)
+      _index_insert(idx, field, it);
+    idx.rebuild=false;
+  }
+  else
+  {
+    for(auto it : idx.dirty)
+    {
+      _index_erase(idx, it);
+      _index_insert(idx, field, it);
+    }
+  }
+  idx.dirty.clear();
+}
+
+void ztd::chunkdat::build_index(std::string const& field)
+{
+  if(this->type()!=ztd::chunk_abstract::list)
+    throw ztd::format_error("Cannot index non-list chunk", "", this->strval(), -1);
+  ztd::chunk_list* cl = dynamic_cast<chunk_list*>(m_achunk);
+  auto fi = cl->indexes.insert(std::make_pair(field, ztd::chunk_list::index())).first;
+  // built now: lookups of unmodified lists only read
+  cl->index_update(fi->first, fi->second);
+}
+
+void ztd::chunkdat::drop_index(std::string const& field)
+{
+  if(this->type()==ztd::chunk_abstract::list)
+    dynamic_cast<chunk_list*>(m_achunk)->indexes.erase(field);
+}
+
+ztd::chunkdat* ztd::chunkdat::find_by(std::string const& field, std::string const& value) const
+{
+  if(this->type()!=ztd::chunk_abstract::list)
+    throw ztd::format_error("Cannot find elements in non-list chunk", "", this->strval(), -1);
+  ztd::chunk_list* cl = dynamic_cast<chunk_list*>(m_achunk);
+  auto fi = cl->indexes.find(field);
+  if(fi != cl->indexes.end()) // indexed
+  {
+    if(fi->second.rebuild || fi->second.dirty.size() > 0) // modified since last lookup
+      cl->index_update(fi->first, fi->second);
+    auto fv = fi->second.values.find(value);
+    if(fv == fi->second.values.end()) //none found
+      return nullptr;
+    return fv->second;
+  }
+  for(auto it : cl->list)
+  {
+    ztd::chunkdat* val = it->subChunkPtr(field);
+    if(val != nullptr && val->type() == ztd::chunk_abstract::string && *val == value.c_str())
+      return it;
+  }
+  return nullptr;
+}
+
+std::vector<ztd::chunkdat*> ztd::chunkdat::find_all_by(std::string const& field, std::string const& value) const
+{
+  if(this->type()!=ztd::chunk_abstract::list)
+    throw ztd::format_error("Cannot find elements in non-list chunk", "", this->strval(), -1);
+  ztd::chunk_list* cl = dynamic_cast<chunk_list*>(m_achunk);
+  std::vector<ztd::chunkdat*> ret;
+  auto fi = cl->indexes.find(field);
+  if(fi != cl->indexes.end()) // indexed
+  {
+    if(fi->second.rebuild || fi->second.dirty.size() > 0) // modified since last lookup
+      cl->index_update(fi->first, fi->second);
+    auto range = fi->second.values.equal_range(value);
+    for(auto it=range.first ; it!=range.second ; it++)
+      ret.push_back(it->second);
+    return ret;
+  }
+  for(auto it : cl->list)
+  {
+    ztd::chunkdat* val = it->subChunkPtr(field);
+    if(val != nullptr && val->type() == ztd::chunk_abstract::string && *val == value.c_str())
+      ret.push_back(it);
+  }
+  return ret;
+}
+
+ztd::chunk_list::chunk_list(std::pmr::memory_resource* resource) : list(resource)
 {
   m_type=ztd::chunk_abstract::list;
 }
@@ -1100,3 +2825,288 @@ ztd::chunk_list::~chunk_list()
     delete it;
   }
 }
+
+static void _diff(const ztd::chunkdat& a, const ztd::chunkdat& b, std::vector<std::string>& path, ztd::chunk_patch& ret)
+{
+  if(a == b) // identical: skip branch
+    return;
+
+  if(a.type()==ztd::chunk_abstract::map && b.type()==ztd::chunk_abstract::map)
+  {
+    ztd::chunk_map* ca = dynamic_cast<ztd::chunk_map*>(a.getp());
+    ztd::chunk_map* cb = dynamic_cast<ztd::chunk_map*>(b.getp());
+    auto ia=ca->values.begin();
+    auto ib=cb->values.begin();
+    // maps are sorted: walk both at once
+    while(ia!=ca->values.end() || ib!=cb->values.end())
+    {
+      path.push_back("");
+      if(ib==cb->values.end() || (ia!=ca->values.end() && ia->first < ib->first) ) // only in a
+      {
+        path.back() = ia->first;
+        ret.entries.push_back( { ztd::patch_entry::remove, path, ztd::chunkdat() } );
+        ia++;
+      }
+      else if(ia==ca->values.end() || ib->first < ia->first) // only in b
+      {
+        path.back() = ib->first;
+        ret.entries.push_back( { ztd::patch_entry::add, path, *ib->second } );
+        ib++;
+      }
+      else // in both
+      {
+        path.back() = ia->first;
+        _diff(*ia->second, *ib->second, path, ret);
+        ia++;
+        ib++;
+      }
+      path.pop_back();
+    }
+  }
+  else if(a.type()==ztd::chunk_abstract::list && b.type()==ztd::chunk_abstract::list)
+  {
+    ztd::chunk_list* ca = dynamic_cast<ztd::chunk_list*>(a.getp());
+    ztd::chunk_list* cb = dynamic_cast<ztd::chunk_list*>(b.getp());
+    size_t i=0;
+    for( ; i<ca->list.size() && i<cb->list.size() ; i++)
+    {
+      path.push_back(std::to_string(i));
+      _diff(*ca->list[i], *cb->list[i], path, ret);
+      path.pop_back();
+    }
+    for( ; i<cb->list.size() ; i++) // appended elements
+    {
+      path.push_back(std::to_string(i));
+      ret.entries.push_back( { ztd::patch_entry::add, path, *cb->list[i] } );
+      path.pop_back();
+    }
+    for(size_t j=ca->list.size() ; j>cb->list.size() ; j--) // removed elements, from the end
+    {
+      path.push_back(std::to_string(j-1));
+      ret.entries.push_back( { ztd::patch_entry::remove, path, ztd::chunkdat() } );
+      path.pop_back();
+    }
+  }
+  else
+  {
+    ret.entries.push_back( { ztd::patch_entry::change, path, b } );
+  }
+}
+
+ztd::chunk_patch ztd::diff(ztd::chunkdat const& a, ztd::chunkdat const& b)
+{
+  ztd::chunk_patch ret;
+  std::vector<std::string> path;
+  _diff(a, b, path, ret);
+  return ret;
+}
+
+static unsigned int _patch_index(ztd::chunkdat const& chk, std::string const& step)
+{
+  if(step.size() <= 0 || step.find_first_not_of("0123456789") != std::string::npos)
+    throw ztd::format_error("Invalid list index '" + step + "' in patch", "", chk.strval(), -1);
+  return std::stoul(step);
+}
+
+void ztd::apply_patch(ztd::chunkdat& chk, ztd::chunk_patch const& patch)
+{
+  for(auto& it : patch.entries)
+  {
+    if(it.path.size() <= 0) // whole chunk
+    {
+      if(it.op != ztd::patch_entry::change)
+        throw ztd::format_error("Patch cannot add or remove top chunk", "", chk.strval(), -1);
+      chk.set(it.value);
+      continue;
+    }
+
+    // get containing chunk
+    ztd::chunkdat* cur = &chk;
+    for(size_t i=0 ; i<it.path.size()-1 ; i++)
+    {
+      if(cur->type() == ztd::chunk_abstract::list)
+        cur = &cur->subChunkRef(_patch_index(*cur, it.path[i]));
+      else
+        cur = &cur->subChunkRef(it.path[i]);
+    }
+
+    std::string const& last = it.path.back();
+    if(cur->type() == ztd::chunk_abstract::list)
+    {
+      unsigned int index = _patch_index(*cur, last);
+      if(it.op == ztd::patch_entry::add)
+      {
+        if(index != (unsigned int) cur->listSize())
+          throw ztd::format_error("Patch adds element " + last + " to list of size " + std::to_string(cur->listSize()), "", cur->strval(), -1);
+        cur->addToList(it.value);
+      }
+      else if(it.op == ztd::patch_entry::remove)
+        cur->erase(index);
+      else
+        cur->subChunkRef(index).set(it.value);
+    }
+    else
+    {
+      if(it.op == ztd::patch_entry::add)
+        cur->addToMap(last, it.value);
+      else if(it.op == ztd::patch_entry::remove)
+        cur->erase(last);
+      else
+        cur->subChunkRef(last).set(it.value);
+    }
+  }
+}
+
+ztd::chunk_patch::chunk_patch()
+{
+}
+
+ztd::chunk_patch::chunk_patch(ztd::chunkdat const& in)
+{
+  set(in);
+}
+
+void ztd::chunk_patch::set(ztd::chunkdat const& in)
+{
+  entries.clear();
+  if(in.type() == ztd::chunk_abstract::none)
+    return;
+  if(in.type() != ztd::chunk_abstract::list)
+    throw ztd::format_error("Patch isn't a list", "", in.strval(), -1);
+
+  for(int i=0 ; i<in.listSize() ; i++)
+  {
+    ztd::chunkdat& chk = in[i];
+    ztd::patch_entry entry;
+    std::string op = chk["op"];
+    if(op == "add")
+      entry.op = ztd::patch_entry::add;
+    else if(op == "remove")
+      entry.op = ztd::patch_entry::remove;
+    else if(op == "change")
+      entry.op = ztd::patch_entry::change;
+    else
+      throw ztd::format_error("Unknown patch operation '" + op + "'", "", chk.strval(), -1);
+
+    ztd::chunkdat& path = chk["path"];
+    for(int j=0 ; j<path.listSize() ; j++)
+      entry.path.push_back(path[j]);
+
+    ztd::chunkdat* value = chk.subChunkPtr("value");
+    if(value != nullptr)
+      entry.value = *value;
+    else if(entry.op != ztd::patch_entry::remove)
+      throw ztd::format_error("Patch operation '" + op + "' has no value", "", chk.strval(), -1);
+
+    entries.push_back(entry);
+  }
+}
+
+// string chunk holding in as is, without parsing it as ZFD
+static ztd::chunkdat _string_chunk(std::string const& in)
+{
+  ztd::chunkdat ret("");
+  dynamic_cast<ztd::chunk_string*>(ret.getp())->val = in;
+  return ret;
+}
+
+ztd::chunkdat ztd::chunk_patch::chunk() const
+{
+  static const char* opnames[] = { "add", "remove", "change" };
+  ztd::chunkdat ret("[]");
+  for(auto& it : entries)
+  {
+    ztd::chunkdat entry("{}");
+    ztd::chunkdat path("[]");
+    for(auto& step : it.path)
+      path.addToList(_string_chunk(step));
+    entry.addToMap("op", opnames[it.op]);
+    entry.addToMap("path", path);
+    if(it.op != ztd::patch_entry::remove)
+      entry.addToMap("value", it.value);
+    ret.addToList(entry);
+  }
+  return ret;
+}
+
+// bring indexes of all lists up to date
+static void _update_indexes(ztd::chunkdat const& chk)
+{
+  ztd::chunk_abstract* cp = chk.getp();
+  if(cp == nullptr)
+    return;
+  if(cp->type() == ztd::chunk_abstract::map)
+  {
+    for(auto& it : dynamic_cast<ztd::chunk_map*>(cp)->values)
+      _update_indexes(*it.second);
+  }
+  else if(cp->type() == ztd::chunk_abstract::list)
+  {
+    ztd::chunk_list* cl = dynamic_cast<ztd::chunk_list*>(cp);
+    for(auto& it : cl->indexes)
+    {
+      if(it.second.rebuild || it.second.dirty.size() > 0)
+        cl->index_update(it.first, it.second);
+    }
+    for(auto it : cl->list)
+      _update_indexes(*it);
+  }
+}
+
+ztd::chunk_publisher::chunk_publisher()
+{
+  m_version=0;
+  this->publish(ztd::chunkdat());
+}
+
+ztd::chunk_publisher::chunk_publisher(ztd::chunkdat const& in)
+{
+  m_version=0;
+  this->publish(in);
+}
+
+void ztd::chunk_publisher::publish(ztd::chunkdat const& in)
+{
+  this->publish(std::make_shared<ztd::chunkdat>(in));
+}
+
+void ztd::chunk_publisher::publish(std::shared_ptr<ztd::chunkdat> in)
+{
+  if(in == nullptr)
+    in = std::make_shared<ztd::chunkdat>();
+  // compute all hashes and update indexes now: readers then never write into the tree
+  in->hash();
+  _update_indexes(*in);
+  std::lock_guard<std::mutex> lck(m_mtx);
+  m_snapshot = in;
+  m_version.fetch_add(1, std::memory_order_release);
+}
+
+ztd::chunk_snapshot ztd::chunk_publisher::acquire() const
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_snapshot;
+}
+
+ztd::chunk_reader::chunk_reader(ztd::chunk_publisher const& pub)
+{
+  m_publisher=&pub;
+  m_version=0;
+}
+
+ztd::chunk_snapshot const& ztd::chunk_reader::acquire()
+{
+  uint64_t ver = m_publisher->version();
+  if(ver != m_version || m_snapshot == nullptr)
+  {
+    m_snapshot = m_publisher->acquire();
+    m_version = ver;
+  }
+  return m_snapshot;
+}
+
+void ztd::chunk_reader::release()
+{
+  m_snapshot=nullptr;
+  m_version=0;
+}
@@ -6,9 +6,30 @@
 #include <strings.h>
 
 #include <unistd.h> // read/write/close
+#include <fcntl.h>
+#include <errno.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <limits.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <deque>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define ZTD_IO_URING
+#endif
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
@@ -16,29 +37,63 @@ ztd::socket_abstract::socket_abstract()
 {
   m_fd=-1;
   m_operational=false;
+  m_loop=nullptr;
   m_thread=nullptr;
   m_parallel=false;
+  m_reading=false;
+  m_pool=nullptr;
+  m_bufferHead=nullptr;
+  m_bufferTail=nullptr;
+  m_buffered=0;
+  m_queued=0;
 }
 
 ztd::socket_abstract::~socket_abstract()
 {
+  // stop the reader before releasing the ring and buffers it uses
+  m_parallel=false;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    if(m_reading && m_fd >= 0)
+      shutdown(m_fd, SHUT_RD); // wake a pending read
+  }
+  m_cv.notify_all();
+  wait_reader();
   killParallel();
   close_socket();
+  while(retrieve_buffer());
 }
 
 void ztd::socket_abstract::close_socket()
 {
+  if(m_loop != nullptr)
+    m_loop->remove(this);
   m_operational=false;
-  close(m_fd);
-  m_fd=-1;
+  {
+    // the destructor can shut down the socket concurrently
+    std::lock_guard<std::mutex> lck(m_mtx);
+    close(m_fd);
+    m_fd=-1;
+  }
   parallelOff();
 }
 
+bool ztd::socket_abstract::set_nonblocking(bool enable)
+{
+  if(m_fd < 0)
+    return false;
+  int flags = fcntl(m_fd, F_GETFL, 0);
+  if(flags < 0)
+    return false;
+  flags = enable ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+  return fcntl(m_fd, F_SETFL, flags) == 0;
+}
+
 bool ztd::socket_abstract::send_string(std::string const& text)
 {
   if(m_fd < 0 || !m_operational)
   return false;
-  if(send(m_fd, text.c_str(), text.size()+1, 0) < 0 )
+  if(send(m_fd, text.c_str(), text.size()+1, MSG_NOSIGNAL) < 0 )
   {
     close_socket();
     return false;
@@ -60,13 +115,391 @@ std::string ztd::socket_abstract::read_string()
   return buf;
 }
 
+// wait until the socket is writable, or tell the caller to queue the rest: non-blocking sockets never wait
+static bool _wait_writable(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  if(flags < 0 || (flags & O_NONBLOCK))
+    return false;
+  struct pollfd pfd = { fd, POLLOUT, 0 };
+  poll(&pfd, 1, -1);
+  return true;
+}
+
 bool ztd::socket_abstract::send_data(uint8_t *data, uint32_t size)
 {
   if(m_fd < 0 || !m_operational)
   return false;
-  if(send(m_fd, data, size, 0) < 0 )
+  if(m_queued > 0) // keep order behind pending data
+  {
+    queue_data(data, size);
+    return flush();
+  }
+  uint32_t sent=0;
+  while(sent < size)
+  {
+    ssize_t n = send(m_fd, data+sent, size-sent, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      if(_wait_writable(m_fd))
+        continue;
+      // non-blocking socket: the rest goes out when writable
+      queue_data(data+sent, size-sent);
+      watch_pending();
+      return true;
+    }
+    if(n < 0)
+    {
+      close_socket();
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+ssize_t ztd::socket_abstract::write_iov(iovec const* base, size_t count)
+{
+  size_t sent=0;
+  // copy of the remaining buffers, only made after a partial write
+  std::vector<iovec> rest;
+  while(count > 0)
+  {
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (iovec*) base;
+    msg.msg_iovlen = std::min(count, (size_t) IOV_MAX);
+    ssize_t n = sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      if(_wait_writable(m_fd))
+        continue;
+      return sent;
+    }
+    if(n < 0)
+      return -1;
+    sent += n;
+    size_t done = n;
+    while(count > 0 && done >= base->iov_len)
+    {
+      done -= base->iov_len;
+      base++;
+      count--;
+    }
+    if(count > 0 && done > 0)
+    {
+      if(rest.empty() || base < rest.data() || base >= rest.data()+rest.size())
+      {
+        rest.assign(base, base+count);
+        base = rest.data();
+      }
+      iovec* first = rest.data() + (base - rest.data());
+      first->iov_base = (uint8_t*) first->iov_base + done;
+      first->iov_len -= done;
+    }
+  }
+  return sent;
+}
+
+bool ztd::socket_abstract::send_iov(std::span<const iovec> iov)
+{
+  if(m_fd < 0 || !m_operational)
+    return false;
+  if(m_queued > 0) // keep order behind pending data
+  {
+    for(auto& it: iov)
+      queue_data((uint8_t const*) it.iov_base, it.iov_len);
+    return flush();
+  }
+  ssize_t n = write_iov(iov.data(), iov.size());
+  if(n < 0)
+  {
+    close_socket();
+    return false;
+  }
+  // non-blocking socket: copy the rest, it goes out when writable
+  size_t skip = n;
+  for(auto& it: iov)
+  {
+    if(skip >= it.iov_len)
+    {
+      skip -= it.iov_len;
+      continue;
+    }
+    queue_data((uint8_t const*) it.iov_base + skip, it.iov_len - skip);
+    skip = 0;
+  }
+  watch_pending();
+  return true;
+}
+
+void ztd::socket_abstract::watch_pending()
+{
+  if(m_queued > 0 && m_loop != nullptr)
+    m_loop->rearm(this);
+}
+
+bool ztd::socket_abstract::send_message(message_framer const& framer, uint8_t const* data, size_t size)
+{
+  if(size > framer.max_size())
+    return false;
+  uint8_t header[10];
+  uint8_t delim = framer.delim();
+  iovec iov[3];
+  size_t n=0;
+  if(m_queued > 0)
+  {
+    if(!flush())
+      return false;
+  }
+  if(framer.mode() == message_framer::varint)
+  {
+    iov[n++] = { header, message_framer::encode_varint(size, header) };
+    iov[n++] = { (void*) data, size };
+  }
+  else
+  {
+    if(memchr(data, delim, size) != NULL)
+      return false;
+    iov[n++] = { (void*) data, size };
+    iov[n++] = { &delim, 1 };
+  }
+  return send_iov(std::span<const iovec>(iov, n));
+}
+
+bool ztd::socket_abstract::read_message(message_framer& framer, std::span<const uint8_t>& message)
+{
+  while(!framer.next(message))
+  {
+    if(framer.error())
+    {
+      close_socket();
+      return false;
+    }
+    std::span<uint8_t> space = framer.prepare(4096);
+    uint32_t size = std::min(space.size(), (size_t) UINT32_MAX);
+    if(!read_data(space.data(), &size))
+      return false;
+    framer.commit(size);
+  }
+  return true;
+}
+
+// errors of the connection, as opposed to errors of the other file
+static bool _connection_error(int err)
+{
+  return err == EPIPE || err == ECONNRESET || err == ENOTCONN || err == ETIMEDOUT;
+}
+
+// append up to size bytes read from fd to out, at offset if not null. False on read error or if fd is shorter
+static bool _read_rest(std::vector<uint8_t>& out, int fd, off_t* offset, size_t size)
+{
+  size_t start = out.size();
+  out.resize(start + size);
+  size_t got=0;
+  while(got < size)
+  {
+    ssize_t n = offset != nullptr ? pread(fd, out.data()+start+got, size-got, *offset+got) : read(fd, out.data()+start+got, size-got);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n <= 0)
+    {
+      out.resize(start + got);
+      return false;
+    }
+    got += n;
+  }
+  return true;
+}
+
+bool ztd::socket_abstract::queue_fd(int fd, off_t* offset, size_t size)
+{
+  std::vector<uint8_t> tmp;
+  bool ret = _read_rest(tmp, fd, offset, size);
+  if(tmp.size() > 0)
+    queue_data(tmp.data(), tmp.size());
+  watch_pending();
+  return ret;
+}
+
+// sendfile/splice have no MSG_NOSIGNAL: block SIGPIPE on this thread for the call
+// and consume the one raised by a closed peer, so the process isn't killed
+class _sigpipe_guard
+{
+public:
+  _sigpipe_guard()
+  {
+    sigset_t pending;
+    sigemptyset(&m_set);
+    sigaddset(&m_set, SIGPIPE);
+    sigemptyset(&pending);
+    sigpending(&pending);
+    m_was_pending = sigismember(&pending, SIGPIPE) == 1;
+    pthread_sigmask(SIG_BLOCK, &m_set, &m_old);
+  }
+  ~_sigpipe_guard()
+  {
+    int err = errno; // keep the error of the guarded call
+    if(!m_was_pending)
+    {
+      struct timespec zero = { 0, 0 };
+      while(sigtimedwait(&m_set, NULL, &zero) < 0 && errno == EINTR);
+    }
+    pthread_sigmask(SIG_SETMASK, &m_old, NULL);
+    errno = err;
+  }
+private:
+  sigset_t m_set;
+  sigset_t m_old;
+  bool m_was_pending;
+};
+
+bool ztd::socket_abstract::send_file(int fd, off_t offset, size_t size)
+{
+  if(m_fd < 0 || !m_operational)
+    return false;
+  if(m_queued > 0 && !flush())
+    return false;
+  if(m_queued > 0) // non-blocking socket with pending data: keep order
+    return queue_fd(fd, &offset, size);
+  _sigpipe_guard guard;
+  while(size > 0)
+  {
+    ssize_t n = sendfile(m_fd, fd, &offset, size);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      if(_wait_writable(m_fd))
+        continue;
+      // non-blocking socket: the rest is copied and goes out when writable
+      return queue_fd(fd, &offset, size);
+    }
+    if(n < 0 && _connection_error(errno))
+      close_socket();
+    // file shorter than expected
+    if(n <= 0)
+      return false;
+    size -= n;
+  }
+  return true;
+}
+
+ssize_t ztd::socket_abstract::splice_out(int fd, size_t size)
+{
+  if(m_fd < 0 || !m_operational)
+    return -1;
+  ssize_t n;
+  _sigpipe_guard guard;
+  do {
+    n = splice(m_fd, NULL, fd, NULL, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  } while(n < 0 && errno == EINTR);
+  if(n == 0 || (n < 0 && _connection_error(errno)))
   {
     close_socket();
+    return n < 0 ? -1 : 0;
+  }
+  return n;
+}
+
+bool ztd::socket_abstract::splice_in(int fd, size_t size)
+{
+  if(m_fd < 0 || !m_operational)
+    return false;
+  if(m_queued > 0 && !flush())
+    return false;
+  if(m_queued > 0) // non-blocking socket with pending data: keep order
+    return queue_fd(fd, nullptr, size);
+  _sigpipe_guard guard;
+  while(size > 0)
+  {
+    ssize_t n = splice(fd, NULL, m_fd, NULL, size, SPLICE_F_MOVE);
+    if(n < 0 && errno == EINTR)
+      continue;
+    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    {
+      if(_wait_writable(m_fd))
+        continue;
+      // non-blocking socket: the rest is read from the pipe and goes out when writable
+      return queue_fd(fd, nullptr, size);
+    }
+    if(n < 0 && _connection_error(errno))
+      close_socket();
+    if(n <= 0)
+      return false;
+    size -= n;
+  }
+  return true;
+}
+
+void ztd::socket_abstract::queue_data(uint8_t const* data, uint32_t size, bool copy)
+{
+  if(size == 0)
+    return;
+  m_queued += size;
+  if(!copy)
+  {
+    m_segments.push_back({ (void*) data, size });
+    return;
+  }
+  m_batch.insert(m_batch.end(), data, data+size);
+  // extend the previous copied segment
+  if(!m_segments.empty() && m_segments.back().iov_base == nullptr)
+    m_segments.back().iov_len += size;
+  else
+    m_segments.push_back({ nullptr, size });
+}
+
+bool ztd::socket_abstract::flush()
+{
+  if(m_segments.empty())
+    return true;
+  // copied segments are laid out in order in the batch buffer, and are pointed to only now
+  size_t offset=0;
+  for(auto& it: m_segments)
+  {
+    if(it.iov_base == nullptr)
+    {
+      it.iov_base = m_batch.data() + offset;
+      offset += it.iov_len;
+    }
+  }
+  ssize_t n = -1;
+  if(m_fd >= 0 && m_operational)
+    n = write_iov(m_segments.data(), m_segments.size());
+  if(n >= 0 && (size_t) n < m_queued)
+  {
+    // non-blocking socket: keep the rest, copied as uncopied data is only guaranteed until flush
+    std::vector<uint8_t> rest;
+    rest.reserve(m_queued - n);
+    size_t skip = n;
+    for(auto& it: m_segments)
+    {
+      if(skip >= it.iov_len)
+      {
+        skip -= it.iov_len;
+        continue;
+      }
+      rest.insert(rest.end(), (uint8_t*) it.iov_base + skip, (uint8_t*) it.iov_base + it.iov_len);
+      skip = 0;
+    }
+    m_batch.swap(rest);
+    m_segments.assign(1, { nullptr, m_batch.size() });
+    m_queued = m_batch.size();
+    watch_pending();
+    return true;
+  }
+  m_segments.clear();
+  m_batch.clear();
+  m_queued=0;
+  if(n < 0)
+  {
+    if(m_fd >= 0)
+      close_socket();
     return false;
   }
   return true;
@@ -76,7 +509,9 @@ bool ztd::socket_abstract::read_data(uint8_t *data, uint32_t *size)
 {
   if(m_fd < 0 || !m_operational)
     return false;
-  uint32_t n = read(m_fd, data, (*size));
+  ssize_t n = read(m_fd, data, (*size));
+  if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return false;
   if(n <= 0)
   {
     close_socket();
@@ -88,34 +523,84 @@ bool ztd::socket_abstract::read_data(uint8_t *data, uint32_t *size)
 
 std::vector<uint8_t> ztd::socket_abstract::retrieve()
 {
-  if(m_dataSet.size() > 0)
+  std::vector<uint8_t> ret;
+  ret.reserve(m_ring.size());
+  std::span<const uint8_t> span;
+  // at most two spans: up to the end of the ring, then from its start
+  while( (span = m_ring.peek()).size() > 0 )
   {
-    std::vector<uint8_t> ret = *m_dataSet.begin();
-    m_dataSet.erase(m_dataSet.begin());
-    return ret;
+    ret.insert(ret.end(), span.begin(), span.end());
+    m_ring.consume(span.size());
+  }
+  {
+    // don't notify between the check and the wait of a full ring
+    std::lock_guard<std::mutex> lck(m_mtx);
+  }
+  m_cv.notify_all();
+  return ret;
+}
+
+void ztd::socket_abstract::consume(size_t n)
+{
+  m_ring.consume(n);
+  {
+    // don't notify between the check and the wait of a full ring
+    std::lock_guard<std::mutex> lck(m_mtx);
   }
-  return std::vector<uint8_t>();
+  m_cv.notify_all();
 }
 
 void ztd::socket_abstract::parallel_on(uint32_t bufferSize)
 {
   if(!m_parallel)
   {
+    // the ring can't be reset under a previous reader
+    wait_reader();
+    m_ring.reset(bufferSize);
+    m_pool=nullptr;
+    m_reading=true;
+    m_parallel=true;
+    std::thread* th = new std::thread(parallel_reading, this);
+    th->detach();
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_thread=th;
+  }
+}
+
+void ztd::socket_abstract::parallel_on(buffer_pool* pool)
+{
+  if(!m_parallel && pool != nullptr)
+  {
+    wait_reader();
+    m_pool=pool;
+    m_reading=true;
     m_parallel=true;
-    m_thread= new std::thread(parallel_reading, this, bufferSize);
-    m_thread->detach();
+    std::thread* th = new std::thread(parallel_reading, this);
+    th->detach();
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_thread=th;
   }
 }
 
 void ztd::socket_abstract::parallelOff()
 {
   m_parallel=false;
-  m_thread=nullptr;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_thread=nullptr;
+  }
   m_cv.notify_all();
 }
 
+void ztd::socket_abstract::wait_reader()
+{
+  std::unique_lock<std::mutex> lck(m_mtx);
+  m_cv.wait(lck, [this] { return !m_reading; });
+}
+
 void ztd::socket_abstract::killParallel()
 {
+  std::lock_guard<std::mutex> lck(m_mtx);
   if(m_thread!=nullptr)
   {
     m_parallel=false;
@@ -132,20 +617,226 @@ void ztd::socket_abstract::wait_data()
   while(!data_available() && m_parallel && m_operational) m_cv.wait(lck);
 }
 
-void ztd::socket_abstract::parallel_reading(ztd::socket_abstract *s, uint32_t bufferSize)
+ztd::pool_buffer ztd::socket_abstract::retrieve_buffer()
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  pool_buffer::block* b = m_bufferHead;
+  if(b == nullptr)
+    return pool_buffer();
+  m_bufferHead = b->next;
+  if(m_bufferHead == nullptr)
+    m_bufferTail = nullptr;
+  m_buffered--;
+  // the queue's reference is handed over
+  return pool_buffer(b);
+}
+
+void ztd::socket_abstract::parallel_reading(ztd::socket_abstract *s)
+{
+  if(s->m_pool != nullptr)
+  {
+    parallel_reading_pool(s);
+    return;
+  }
+  while(s->parallel() && s->operational())
+  {
+    // read straight into the ring
+    std::span<uint8_t> span = s->m_ring.write_span();
+    if(span.size() == 0)
+    {
+      // woken by consume(), retrieve() or parallelOff()
+      std::unique_lock<std::mutex> lck(s->m_mtx);
+      s->m_cv.wait(lck, [s] { return s->m_ring.size() < s->m_ring.capacity() || !s->parallel() || !s->operational(); });
+      continue;
+    }
+    uint32_t tmp_size = span.size();
+    if(s->read_data(span.data(), &tmp_size))
+      s->m_ring.commit(tmp_size);
+    {
+      // don't notify between the check and the wait of wait_data()
+      std::lock_guard<std::mutex> lck(s->m_mtx);
+    }
+    s->cv().notify_all();
+  }
+  std::lock_guard<std::mutex> lck(s->m_mtx);
+  s->m_reading=false;
+  s->m_cv.notify_all();
+}
+
+void ztd::socket_abstract::parallel_reading_pool(ztd::socket_abstract *s)
 {
-  uint8_t *buffer = (uint8_t*) malloc(bufferSize);
-  uint32_t tmp_size;
   while(s->parallel() && s->operational())
   {
-    tmp_size=bufferSize;
-    if(s->read_data(buffer, &tmp_size))
+    pool_buffer buf = s->m_pool->acquire();
+    uint32_t tmp_size = buf.capacity();
+    if(s->read_data(buf.data(), &tmp_size))
     {
-      s->data().push_back(std::vector<uint8_t>(buffer, buffer+tmp_size));
+      buf.resize(tmp_size);
+      std::lock_guard<std::mutex> lck(s->m_mtx);
+      pool_buffer::block* b = buf.m_block;
+      buf.m_block = nullptr;
+      b->next = nullptr;
+      if(s->m_bufferTail != nullptr)
+        s->m_bufferTail->next = b;
+      else
+        s->m_bufferHead = b;
+      s->m_bufferTail = b;
+      s->m_buffered++;
     }
     s->cv().notify_all();
   }
-  free(buffer);
+  std::lock_guard<std::mutex> lck(s->m_mtx);
+  s->m_reading=false;
+  s->m_cv.notify_all();
+}
+
+ztd::spsc_ring::spsc_ring(size_t capacity)
+{
+  m_capacity=0;
+  m_head=0;
+  m_tail=0;
+  reset(capacity);
+}
+
+void ztd::spsc_ring::reset(size_t capacity)
+{
+  size_t cap = capacity > 0 ? 1 : 0;
+  while(cap < capacity)
+    cap <<= 1;
+  if(cap != m_capacity)
+  {
+    m_data.reset(cap > 0 ? new uint8_t[cap] : nullptr);
+    m_capacity=cap;
+  }
+  m_head.store(0, std::memory_order_relaxed);
+  m_tail.store(0, std::memory_order_relaxed);
+}
+
+std::span<uint8_t> ztd::spsc_ring::write_span()
+{
+  size_t tail = m_tail.load(std::memory_order_relaxed);
+  size_t head = m_head.load(std::memory_order_acquire);
+  size_t offset = tail & (m_capacity-1);
+  size_t n = std::min(m_capacity - (tail-head), m_capacity - offset);
+  return std::span<uint8_t>(m_data.get() + offset, n);
+}
+
+void ztd::spsc_ring::commit(size_t n)
+{
+  m_tail.store(m_tail.load(std::memory_order_relaxed) + n, std::memory_order_release);
+}
+
+size_t ztd::spsc_ring::write(uint8_t const* data, size_t size)
+{
+  size_t done=0;
+  std::span<uint8_t> span;
+  while(done < size && (span = write_span()).size() > 0)
+  {
+    size_t n = std::min(span.size(), size-done);
+    memcpy(span.data(), data+done, n);
+    commit(n);
+    done += n;
+  }
+  return done;
+}
+
+std::span<const uint8_t> ztd::spsc_ring::peek() const
+{
+  size_t head = m_head.load(std::memory_order_relaxed);
+  size_t tail = m_tail.load(std::memory_order_acquire);
+  size_t offset = head & (m_capacity-1);
+  size_t n = std::min(tail-head, m_capacity - offset);
+  return std::span<const uint8_t>(m_data.get() + offset, n);
+}
+
+void ztd::spsc_ring::consume(size_t n)
+{
+  m_head.store(m_head.load(std::memory_order_relaxed) + n, std::memory_order_release);
+}
+
+size_t ztd::spsc_ring::read(uint8_t* data, size_t size)
+{
+  size_t done=0;
+  std::span<const uint8_t> span;
+  while(done < size && (span = peek()).size() > 0)
+  {
+    size_t n = std::min(span.size(), size-done);
+    memcpy(data+done, span.data(), n);
+    consume(n);
+    done += n;
+  }
+  return done;
+}
+
+ztd::splice_pipe::splice_pipe(size_t size)
+{
+  m_capacity=0;
+  if(pipe2(m_pipe, O_CLOEXEC) < 0)
+  {
+    m_pipe[0] = m_pipe[1] = -1;
+    return;
+  }
+  fcntl(m_pipe[1], F_SETPIPE_SZ, (int) std::min(size, (size_t) INT_MAX));
+  int cap = fcntl(m_pipe[1], F_GETPIPE_SZ);
+  m_capacity = cap > 0 ? cap : 4096;
+}
+
+ztd::splice_pipe::~splice_pipe()
+{
+  if(m_pipe[0] >= 0)
+  {
+    close(m_pipe[0]);
+    close(m_pipe[1]);
+  }
+}
+
+ssize_t ztd::splice_pipe::forward(socket_abstract& from, socket_abstract& to, size_t size)
+{
+  if(!valid())
+    return -1;
+  // the pipe is always drained entirely, so it is empty here
+  ssize_t n = from.splice_out(m_pipe[1], std::min(size, m_capacity));
+  if(n <= 0)
+    return n;
+  if(!to.splice_in(m_pipe[0], n))
+  {
+    // discard what is left in the pipe
+    uint8_t buf[4096];
+    struct pollfd pfd = { m_pipe[0], POLLIN, 0 };
+    while(poll(&pfd, 1, 0) > 0 && read(m_pipe[0], buf, sizeof(buf)) > 0);
+    return -1;
+  }
+  return n;
+}
+
+bool ztd::splice_pipe::proxy(socket_abstract& a, socket_abstract& b)
+{
+  splice_pipe pipe;
+  if(!pipe.valid())
+    return false;
+  while(a.operational() && b.operational())
+  {
+    struct pollfd pfd[2] = { { a.fd(), POLLIN, 0 }, { b.fd(), POLLIN, 0 } };
+    if(poll(pfd, 2, -1) < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      return false;
+    }
+    for(int i=0; i<2; i++)
+    {
+      if(pfd[i].revents == 0)
+        continue;
+      socket_abstract& from = i == 0 ? a : b;
+      socket_abstract& to = i == 0 ? b : a;
+      ssize_t n = pipe.forward(from, to);
+      if(n == 0)
+        return true;
+      if(n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        return !from.operational() || !to.operational();
+    }
+  }
+  return true;
 }
 
 ztd::tcpsocket_abstract::tcpsocket_abstract()
@@ -177,6 +868,12 @@ ztd::tcpsocket_server::~tcpsocket_server()
 {
 }
 
+bool ztd::tcpsocket_server::set_reuseport(bool enable)
+{
+  int val = enable ? 1 : 0;
+  return setsockopt(m_fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val)) == 0;
+}
+
 bool ztd::tcpsocket_server::listen_ipv4(uint16_t port, int backlog)
 {
   m_port=port;
@@ -187,11 +884,10 @@ bool ztd::tcpsocket_server::listen_ipv4(uint16_t port, int backlog)
   m_servaddr.sin_port = htons(m_port);
   if(bind(m_fd, (struct sockaddr *) &m_servaddr, sizeof(m_servaddr)) < 0) //binding
     return false;
-  listen(m_fd, 5);
-  if(m_fd < 0)
+  if(listen(m_fd, backlog) < 0)
     return false;
   m_listening=true;
-    return true;
+  return true;
 }
 
 bool ztd::tcpsocket_server::listen_ipv6(uint16_t port, int backlog)
@@ -199,13 +895,14 @@ bool ztd::tcpsocket_server::listen_ipv6(uint16_t port, int backlog)
   m_port=port;
   if(m_port == 0)
     return false;
-  m_servaddr.sin_family = AF_INET6;
-  m_servaddr.sin_addr.s_addr = INADDR_ANY;
-  m_servaddr.sin_port = htons(m_port);
-  if(bind(m_fd, (struct sockaddr *) &m_servaddr, sizeof(m_servaddr)) < 0) //binding
+  struct sockaddr_in6 addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin6_family = AF_INET6;
+  addr.sin6_addr = in6addr_any;
+  addr.sin6_port = htons(m_port);
+  if(bind(m_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) //binding
     return false;
-  listen(m_fd, backlog);
-  if(m_fd < 0)
+  if(listen(m_fd, backlog) < 0)
     return false;
   m_listening=true;
   return true;
@@ -214,19 +911,22 @@ bool ztd::tcpsocket_server::listen_ipv6(uint16_t port, int backlog)
 ztd::tcpsocket_server_instance::tcpsocket_server_instance(ztd::tcpsocket_server *server)
 {
   m_server=server;
+  memset(&m_cliaddr, 0, sizeof(m_cliaddr));
   m_clilen=sizeof(m_cliaddr);
+  m_cliname[0] = 0;
 }
 ztd::tcpsocket_server_instance::~tcpsocket_server_instance()
 {
 }
 
-bool ztd::tcpsocket_server_instance::accept_connection()
+bool ztd::tcpsocket_server_instance::accept_connection(bool nonblocking)
 {
   if(m_server == nullptr)
     return false;
   if(!m_server->is_open())
     return false;
-  m_fd = accept(m_server->fd(), (struct sockaddr *) &m_cliaddr, &m_clilen);
+  m_clilen=sizeof(m_cliaddr);
+  m_fd = accept4(m_server->fd(), (struct sockaddr *) &m_cliaddr, &m_clilen, SOCK_CLOEXEC | (nonblocking ? SOCK_NONBLOCK : 0));
   if(m_fd < 0)
     return false;
 
@@ -236,46 +936,1692 @@ bool ztd::tcpsocket_server_instance::accept_connection()
 
 char* ztd::tcpsocket_server_instance::client_address()
 {
-  return inet_ntoa(m_cliaddr.sin_addr);
+  void const* addr = m_cliaddr.ss_family == AF_INET6 ? (void const*) &((struct sockaddr_in6*) &m_cliaddr)->sin6_addr : (void const*) &((struct sockaddr_in*) &m_cliaddr)->sin_addr;
+  if(inet_ntop(m_cliaddr.ss_family, addr, m_cliname, sizeof(m_cliname)) == NULL)
+    m_cliname[0] = 0;
+  return m_cliname;
 }
 uint16_t ztd::tcpsocket_server_instance::client_port()
 {
-  return ntohs(m_cliaddr.sin_port);
+  if(m_cliaddr.ss_family == AF_INET6)
+    return ntohs(((struct sockaddr_in6*) &m_cliaddr)->sin6_port);
+  if(m_cliaddr.ss_family == AF_INET)
+    return ntohs(((struct sockaddr_in*) &m_cliaddr)->sin_port);
+  return 0;
+}
+
+ztd::reuseport_server::reuseport_server()
+{
+  m_evfd=-1;
+}
+
+ztd::reuseport_server::~reuseport_server()
+{
+  stop();
+}
+
+bool ztd::reuseport_server::open(uint16_t port, unsigned int workers, int backlog, bool ipv6)
+{
+  if(!m_listeners.empty())
+    return false;
+  if(workers == 0)
+    workers = std::max(std::thread::hardware_concurrency(), 1u);
+  for(unsigned int i=0; i<workers; i++)
+  {
+    tcpsocket_server* server = new tcpsocket_server;
+    m_listeners.push_back(std::unique_ptr<tcpsocket_server>(server));
+    bool ok = ipv6 ? server->init_ipv6() : server->init_ipv4();
+    if(!ok || !server->set_reuseport() || !server->set_nonblocking()
+      || !(ipv6 ? server->listen_ipv6(port, backlog) : server->listen_ipv4(port, backlog)) )
+    {
+      m_listeners.clear();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ztd::reuseport_server::listen_ipv4(uint16_t port, unsigned int workers, int backlog)
+{
+  return open(port, workers, backlog, false);
+}
+
+bool ztd::reuseport_server::listen_ipv6(uint16_t port, unsigned int workers, int backlog)
+{
+  return open(port, workers, backlog, true);
+}
+
+bool ztd::reuseport_server::start(accept_callback on_accept, bool pin)
+{
+  if(m_listeners.empty() || !m_threads.empty() || !on_accept)
+    return false;
+  m_evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(m_evfd < 0)
+    return false;
+  m_onAccept = on_accept;
+  unsigned int cpus = std::max(std::thread::hardware_concurrency(), 1u);
+  for(unsigned int i=0; i<m_listeners.size(); i++)
+  {
+    if(pin)
+    {
+      int cpu = i % cpus;
+      setsockopt(m_listeners[i]->fd(), SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+    }
+    m_threads.push_back(std::thread(&reuseport_server::work, this, i));
+    if(pin)
+    {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(i % cpus, &set);
+      pthread_setaffinity_np(m_threads.back().native_handle(), sizeof(set), &set);
+    }
+  }
+  return true;
+}
+
+#define ACCEPT_BACKOFF_MS 100
+
+void ztd::reuseport_server::work(unsigned int worker)
+{
+  tcpsocket_server* server = m_listeners[worker].get();
+  struct pollfd pfd[2] = { { server->fd(), POLLIN, 0 }, { m_evfd, POLLIN, 0 } };
+  while(true)
+  {
+    if(poll(pfd, 2, -1) < 0)
+    {
+      if(errno == EINTR)
+        continue;
+      return;
+    }
+    if(pfd[1].revents != 0)
+      return;
+    // accept everything pending
+    while(true)
+    {
+      tcpsocket_server_instance* inst = new tcpsocket_server_instance(server);
+      if(!inst->accept_connection(true))
+      {
+        int err = errno;
+        delete inst;
+        if(err == EINTR || err == ECONNABORTED)
+          continue;
+        // out of descriptors or memory: the connection stays pending, wait before retrying
+        if(err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM)
+        {
+          if(poll(&pfd[1], 1, ACCEPT_BACKOFF_MS) > 0)
+            return;
+        }
+        break;
+      }
+      m_onAccept(inst, worker);
+    }
+  }
+}
+
+void ztd::reuseport_server::stop()
+{
+  if(m_evfd >= 0)
+  {
+    uint64_t val=1;
+    if(write(m_evfd, &val, sizeof(val)) < 0) {}
+  }
+  for(auto& it: m_threads)
+    it.join();
+  m_threads.clear();
+  if(m_evfd >= 0)
+    close(m_evfd);
+  m_evfd=-1;
+}
+
+struct _resolver_entry {
+  std::chrono::steady_clock::time_point expiry;
+  std::vector<ztd::resolver::address> addresses;
+};
+
+#define RESOLVER_CACHE_SIZE 256
+
+static std::mutex _resolver_mtx;
+static std::unordered_map<std::string, _resolver_entry> _resolver_cache;
+static std::chrono::milliseconds _resolver_ttl(30000);
+
+struct _gai_request {
+  std::string host;
+  struct addrinfo hints;
+  struct gaicb cb;
+};
+
+// wait for a request, then free it
+static void _gai_release(_gai_request* req)
+{
+  struct gaicb* list[1] = { &req->cb };
+  while(gai_error(&req->cb) == EAI_INPROGRESS)
+    gai_suspend(list, 1, NULL);
+  if(req->cb.ar_result != NULL)
+    freeaddrinfo(req->cb.ar_result);
+  delete req;
+}
+
+// getaddrinfo() giving up after timeout milliseconds, -1 for none
+static int _getaddrinfo(std::string const& host, struct addrinfo const* hints, struct addrinfo** res, int timeout)
+{
+  if(timeout < 0)
+    return getaddrinfo(host.c_str(), NULL, hints, res);
+
+  _gai_request* req = new _gai_request;
+  req->host = host;
+  req->hints = *hints;
+  memset(&req->cb, 0, sizeof(req->cb));
+  req->cb.ar_name = req->host.c_str();
+  req->cb.ar_request = &req->hints;
+  struct gaicb* list[1] = { &req->cb };
+  int ret = getaddrinfo_a(GAI_NOWAIT, list, 1, NULL);
+  if(ret != 0)
+  {
+    delete req;
+    return ret;
+  }
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  while( (ret = gai_error(&req->cb)) == EAI_INPROGRESS )
+  {
+    auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if(left <= 0)
+      break;
+    struct timespec ts = { (time_t) (left / 1000000000), (long) (left % 1000000000) };
+    gai_suspend(list, 1, &ts);
+  }
+  if(ret == EAI_INPROGRESS)
+  {
+    // timed out: a lookup already running can't be stopped, free it once done
+    if(gai_cancel(&req->cb) == EAI_CANCELED)
+      delete req;
+    else
+      std::thread(_gai_release, req).detach();
+    return EAI_AGAIN;
+  }
+  *res = req->cb.ar_result;
+  delete req;
+  return ret;
+}
+
+std::vector<ztd::resolver::address> ztd::resolver::resolve(std::string const& host, uint16_t port, int family, int timeout)
+{
+  std::vector<address> ret;
+  std::string key = std::to_string(family) + ' ' + host;
+  auto now = std::chrono::steady_clock::now();
+  bool cached=false;
+  {
+    std::lock_guard<std::mutex> lck(_resolver_mtx);
+    auto it = _resolver_cache.find(key);
+    if(it != _resolver_cache.end() && it->second.expiry > now)
+    {
+      ret = it->second.addresses;
+      cached=true;
+    }
+  }
+
+  if(!cached)
+  {
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = family;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    if(_getaddrinfo(host, &hints, &res, timeout) != 0)
+      return ret;
+    for(struct addrinfo* ai=res; ai!=NULL; ai=ai->ai_next)
+    {
+      if(ai->ai_family != AF_INET && ai->ai_family != AF_INET6)
+        continue;
+      address a;
+      memset(&a.addr, 0, sizeof(a.addr));
+      memcpy(&a.addr, ai->ai_addr, ai->ai_addrlen);
+      a.len = ai->ai_addrlen;
+      ret.push_back(a);
+    }
+    freeaddrinfo(res);
+
+    std::lock_guard<std::mutex> lck(_resolver_mtx);
+    if(_resolver_ttl.count() > 0 && ret.size() > 0)
+    {
+      if(_resolver_cache.size() >= RESOLVER_CACHE_SIZE)
+      {
+        // drop expired entries, or the one expiring first
+        std::erase_if(_resolver_cache, [now](auto const& it) { return it.second.expiry <= now; });
+        if(_resolver_cache.size() >= RESOLVER_CACHE_SIZE)
+          _resolver_cache.erase(std::min_element(_resolver_cache.begin(), _resolver_cache.end(),
+            [](auto const& a, auto const& b) { return a.second.expiry < b.second.expiry; }));
+      }
+      _resolver_cache[key] = { now + _resolver_ttl, ret };
+    }
+  }
+
+  for(auto& it: ret)
+  {
+    if(it.family() == AF_INET)
+      ((struct sockaddr_in*) &it.addr)->sin_port = htons(port);
+    else
+      ((struct sockaddr_in6*) &it.addr)->sin6_port = htons(port);
+  }
+  return ret;
+}
+
+void ztd::resolver::set_ttl(std::chrono::milliseconds ttl)
+{
+  std::lock_guard<std::mutex> lck(_resolver_mtx);
+  _resolver_ttl = ttl;
+  if(ttl.count() <= 0)
+    _resolver_cache.clear();
+}
+
+void ztd::resolver::clear()
+{
+  std::lock_guard<std::mutex> lck(_resolver_mtx);
+  _resolver_cache.clear();
+}
+
+// milliseconds left until deadline, -1 if none
+static int _remaining(std::chrono::steady_clock::time_point deadline, bool has_deadline)
+{
+  if(!has_deadline)
+    return -1;
+  auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+  return left > 0 ? left : 0;
+}
+
+// connect a socket within a timeout, leaves the socket blocking mode unchanged
+static bool _connect_timeout(int fd, struct sockaddr const* addr, socklen_t len, int timeout)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    return false;
+  bool ret=false;
+  if(connect(fd, addr, len) == 0)
+    ret=true;
+  else if(errno == EINPROGRESS)
+  {
+    struct pollfd pfd = { fd, POLLOUT, 0 };
+    int n;
+    while( (n = poll(&pfd, 1, timeout)) < 0 && errno == EINTR);
+    int err=0;
+    socklen_t errlen = sizeof(err);
+    if(n > 0 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0 && err == 0)
+      ret=true;
+  }
+  fcntl(fd, F_SETFL, flags);
+  return ret;
+}
+
+// copy file status flags and common options to a replacement socket
+static void _copy_settings(int from, int to)
+{
+  int flags = fcntl(from, F_GETFL, 0);
+  if(flags >= 0)
+    fcntl(to, F_SETFL, flags);
+  static const int opts[][2] = { {SOL_SOCKET, SO_REUSEADDR}, {SOL_SOCKET, SO_KEEPALIVE}, {IPPROTO_TCP, TCP_NODELAY} };
+  for(auto& it: opts)
+  {
+    int val=0;
+    socklen_t len = sizeof(val);
+    if(getsockopt(from, it[0], it[1], &val, &len) == 0 && val != 0)
+      setsockopt(to, it[0], it[1], &val, len);
+  }
 }
 
 ztd::tcpsocket_client::tcpsocket_client()
 {
-  bzero( (char *) &m_servaddr, sizeof(m_servaddr));
-  m_server=nullptr;
+  memset(&m_servaddr, 0, sizeof(m_servaddr));
+  m_port=0;
 }
 ztd::tcpsocket_client::~tcpsocket_client()
 {
 }
 
-bool ztd::tcpsocket_client::connect_ipv4(std::string const& addr, uint16_t port)
+bool ztd::tcpsocket_client::connect_family(std::string const& addr, uint16_t port, int family, int timeout)
 {
   m_addr=addr;
   m_port = port;
-  m_server = gethostbyname(m_addr.c_str());
-  m_servaddr.sin_family = AF_INET;
-  bcopy((char *)m_server->h_addr, (char *)&m_servaddr.sin_addr.s_addr, m_server->h_length);
-  m_servaddr.sin_port = htons(m_port);
-  if(connect(m_fd, (struct sockaddr *) &m_servaddr, sizeof(m_servaddr)) < 0)
+  if(m_fd < 0)
     return false;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+  for(auto& it: resolver::resolve(addr, port, family, timeout))
+  {
+    if(_connect_timeout(m_fd, (struct sockaddr*) &it.addr, it.len, _remaining(deadline, timeout >= 0)))
+    {
+      m_servaddr = it.addr;
+      m_operational = true;
+      return true;
+    }
+    // a failed connect leaves the socket unusable: replace it, keeping its settings
+    int fd = socket(family, SOCK_STREAM, 0);
+    if(fd < 0)
+      return false;
+    _copy_settings(m_fd, fd);
+    int fdflags = fcntl(m_fd, F_GETFD, 0);
+    dup2(fd, m_fd);
+    close(fd);
+    if(fdflags >= 0)
+      fcntl(m_fd, F_SETFD, fdflags);
+    if(timeout >= 0 && _remaining(deadline, true) == 0)
+      break;
+  }
+  return false;
+}
+
+bool ztd::tcpsocket_client::connect_ipv4(std::string const& addr, uint16_t port, int timeout)
+{
+  return connect_family(addr, port, AF_INET, timeout);
+}
+
+bool ztd::tcpsocket_client::connect_ipv6(std::string const& addr, uint16_t port, int timeout)
+{
+  return connect_family(addr, port, AF_INET6, timeout);
+}
+
+bool ztd::tcpsocket_client::connect(std::string const& host, uint16_t port, int timeout, int attemptDelay)
+{
+  typedef std::chrono::steady_clock clock;
+  m_addr=host;
+  m_port=port;
+  auto deadline = clock::now() + std::chrono::milliseconds(timeout);
+  std::vector<resolver::address> resolved = resolver::resolve(host, port, AF_UNSPEC, timeout);
+  // alternate address families, starting with the preferred one
+  std::vector<resolver::address> addrs;
+  {
+    std::vector<resolver::address> first, second;
+    for(auto& it: resolved)
+      (it.family() == resolved[0].family() ? first : second).push_back(it);
+    for(size_t i=0; i<first.size() || i<second.size(); i++)
+    {
+      if(i < first.size())
+        addrs.push_back(first[i]);
+      if(i < second.size())
+        addrs.push_back(second[i]);
+    }
+  }
+
+  auto next_start = clock::now();
+  size_t next=0;
+  std::vector<struct pollfd> attempts;
+  std::vector<size_t> attempt_addr;
+  int winner=-1;
+  size_t winner_addr=0;
+  while(winner < 0)
+  {
+    auto now = clock::now();
+    if(timeout >= 0 && now >= deadline)
+      break;
+    if(next < addrs.size() && now >= next_start)
+    {
+      resolver::address& a = addrs[next];
+      int fd = socket(a.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+      if(fd >= 0 && ::connect(fd, (struct sockaddr*) &a.addr, a.len) == 0)
+      {
+        winner=fd;
+        winner_addr=next;
+        break;
+      }
+      if(fd >= 0 && errno == EINPROGRESS)
+      {
+        attempts.push_back({ fd, POLLOUT, 0 });
+        attempt_addr.push_back(next);
+        next_start = now + std::chrono::milliseconds(attemptDelay);
+      }
+      else if(fd >= 0)
+        close(fd);
+      next++;
+      continue;
+    }
+    if(attempts.empty() && next >= addrs.size())
+      break;
+
+    int wait = _remaining(deadline, timeout >= 0);
+    if(next < addrs.size())
+    {
+      int until_next = _remaining(next_start, true);
+      wait = wait < 0 ? until_next : std::min(wait, until_next);
+    }
+    if(poll(attempts.data(), attempts.size(), wait) < 0 && errno != EINTR)
+      break;
+    for(size_t i=0; i<attempts.size(); )
+    {
+      if(attempts[i].revents == 0)
+      {
+        i++;
+        continue;
+      }
+      int err=0;
+      socklen_t errlen = sizeof(err);
+      if(getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == 0 && err == 0)
+      {
+        winner = attempts[i].fd;
+        winner_addr = attempt_addr[i];
+        attempts.erase(attempts.begin()+i);
+        break;
+      }
+      // failed: start the next address right away
+      close(attempts[i].fd);
+      attempts.erase(attempts.begin()+i);
+      attempt_addr.erase(attempt_addr.begin()+i);
+      next_start = clock::now();
+    }
+  }
+  for(auto& it: attempts)
+    close(it.fd);
+  if(winner < 0)
+    return false;
+
+  int flags = fcntl(winner, F_GETFL, 0);
+  fcntl(winner, F_SETFL, flags & ~O_NONBLOCK);
+  if(m_fd >= 0)
+    close_socket();
+  m_fd = winner;
+  m_servaddr = addrs[winner_addr].addr;
   m_operational = true;
   return true;
 }
 
-bool ztd::tcpsocket_client::connect_ipv6(std::string const& addr, uint16_t port)
+ztd::connection_pool::connection_pool(size_t maxSize, size_t maxIdle, size_t minIdle, std::chrono::milliseconds idleTimeout, int connectTimeout)
 {
-  m_addr=addr;
-  m_port = port;
-  m_server = gethostbyname(m_addr.c_str());
-  m_servaddr.sin_family = AF_INET6;
-  bcopy((char *)m_server->h_addr, (char *)&m_servaddr.sin_addr.s_addr, m_server->h_length);
-  m_servaddr.sin_port = htons(m_port);
-  if(connect(m_fd, (struct sockaddr *) &m_servaddr, sizeof(m_servaddr)) < 0)
+  m_maxSize=maxSize;
+  m_maxIdle=maxIdle;
+  m_minIdle=minIdle;
+  m_idleTimeout=idleTimeout;
+  m_connectTimeout=connectTimeout;
+}
+
+ztd::connection_pool::~connection_pool()
+{
+  clear();
+}
+
+std::string ztd::connection_pool::key(std::string const& host, uint16_t port)
+{
+  return host + ' ' + std::to_string(port);
+}
+
+bool ztd::connection_pool::alive(socket_abstract* socket)
+{
+  if(socket->fd() < 0 || !socket->operational())
     return false;
-  m_operational = true;
+  int err=0;
+  socklen_t errlen = sizeof(err);
+  if(getsockopt(socket->fd(), SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err != 0)
+    return false;
+  // an idle connection has nothing to read: EOF or leftover data both disqualify it
+  uint8_t c;
+  ssize_t n = recv(socket->fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+void ztd::connection_pool::evict(host_pool& pool, std::chrono::steady_clock::time_point now, std::vector<tcpsocket_client*>& closed)
+{
+  while(pool.idle.size() > m_minIdle && now - pool.idle.front().since >= m_idleTimeout)
+  {
+    closed.push_back(pool.idle.front().client);
+    pool.idle.pop_front();
+  }
+}
+
+ztd::tcpsocket_client* ztd::connection_pool::checkout(std::string const& host, uint16_t port)
+{
+  std::vector<tcpsocket_client*> closed;
+  tcpsocket_client* ret=nullptr;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    host_pool& pool = m_pools[key(host, port)];
+    evict(pool, std::chrono::steady_clock::now(), closed);
+    while(ret == nullptr && !pool.idle.empty())
+    {
+      tcpsocket_client* c = pool.idle.back().client;
+      pool.idle.pop_back();
+      if(alive(c))
+        ret = c;
+      else
+        closed.push_back(c);
+    }
+    if(ret == nullptr && m_maxSize > 0 && pool.active >= m_maxSize)
+    {
+      for(auto it: closed)
+        delete it;
+      return nullptr;
+    }
+    // counted before connecting so concurrent checkouts respect the limit
+    pool.active++;
+  }
+  for(auto it: closed)
+    delete it;
+  if(ret != nullptr)
+    return ret;
+
+  ret = new tcpsocket_client;
+  if(!ret->connect(host, port, m_connectTimeout))
+  {
+    delete ret;
+    std::lock_guard<std::mutex> lck(m_mtx);
+    m_pools[key(host, port)].active--;
+    return nullptr;
+  }
+  int one=1;
+  setsockopt(ret->fd(), SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+  return ret;
+}
+
+void ztd::connection_pool::checkin(tcpsocket_client* client)
+{
+  if(client == nullptr)
+    return;
+  std::vector<tcpsocket_client*> closed;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    host_pool& pool = m_pools[key(client->addr(), client->port())];
+    if(pool.active > 0)
+      pool.active--;
+    auto now = std::chrono::steady_clock::now();
+    evict(pool, now, closed);
+    if(client->operational() && !client->parallel() && client->loop() == nullptr && pool.idle.size() < m_maxIdle)
+    {
+      pool.idle.push_back({ client, now });
+      client=nullptr;
+    }
+  }
+  delete client;
+  for(auto it: closed)
+    delete it;
+}
+
+void ztd::connection_pool::evict()
+{
+  std::vector<tcpsocket_client*> closed;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    auto now = std::chrono::steady_clock::now();
+    for(auto& it: m_pools)
+      evict(it.second, now, closed);
+  }
+  for(auto it: closed)
+    delete it;
+}
+
+void ztd::connection_pool::clear()
+{
+  std::vector<tcpsocket_client*> closed;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    for(auto& it: m_pools)
+    {
+      for(auto& c: it.second.idle)
+        closed.push_back(c.client);
+      it.second.idle.clear();
+    }
+  }
+  for(auto it: closed)
+    delete it;
+}
+
+size_t ztd::connection_pool::idle()
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  size_t ret=0;
+  for(auto& it: m_pools)
+    ret += it.second.idle.size();
+  return ret;
+}
+
+size_t ztd::connection_pool::active(std::string const& host, uint16_t port)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  auto it = m_pools.find(key(host, port));
+  return it != m_pools.end() ? it->second.active : 0;
+}
+
+ztd::event_loop::event_loop()
+{
+  m_stop=false;
+  m_epfd = epoll_create1(EPOLL_CLOEXEC);
+  m_evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if(m_epfd >= 0 && m_evfd >= 0 && m_timerfd >= 0)
+  {
+    struct epoll_event ev, tev;
+    ev.events = EPOLLIN;
+    ev.data.fd = m_evfd;
+    tev.events = EPOLLIN | EPOLLET;
+    tev.data.fd = m_timerfd;
+    if(epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_evfd, &ev) == 0 && epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_timerfd, &tev) == 0)
+      return;
+  }
+  if(m_epfd >= 0)
+    close(m_epfd);
+  if(m_evfd >= 0)
+    close(m_evfd);
+  if(m_timerfd >= 0)
+    close(m_timerfd);
+  m_epfd = m_evfd = m_timerfd = -1;
+}
+
+ztd::event_loop::~event_loop()
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  for(auto& it: m_handlers)
+    it.second->socket->m_loop=nullptr;
+  m_handlers.clear();
+  if(m_epfd >= 0)
+    close(m_epfd);
+  if(m_evfd >= 0)
+    close(m_evfd);
+  if(m_timerfd >= 0)
+    close(m_timerfd);
+}
+
+bool ztd::event_loop::arm(int fd, handler* h, int op)
+{
+  struct epoll_event ev;
+  ev.events = EPOLLIN | EPOLLET | EPOLLONESHOT;
+  if(h->server == nullptr)
+    ev.events |= EPOLLRDHUP;
+  // queued data left by a partial flush goes out when writable
+  if(h->write || (h->server == nullptr && h->socket->queued() > 0))
+    ev.events |= EPOLLOUT;
+  ev.data.fd = fd;
+  return epoll_ctl(m_epfd, op, fd, &ev) == 0;
+}
+
+bool ztd::event_loop::attach(std::shared_ptr<handler> h)
+{
+  socket_abstract* s = h->socket;
+  if(m_epfd < 0 || s->fd() < 0 || !s->set_nonblocking())
+    return false;
+  std::lock_guard<std::mutex> lck(m_mtx);
+  if(s->m_loop != nullptr || m_handlers.find(s->fd()) != m_handlers.end())
+    return false;
+  if(!arm(s->fd(), h.get(), EPOLL_CTL_ADD))
+    return false;
+  m_handlers[s->fd()] = h;
+  s->m_loop = this;
   return true;
 }
+
+bool ztd::event_loop::add_server(tcpsocket_server* server, accept_callback on_accept)
+{
+  if(!server->is_open() || !on_accept)
+    return false;
+  std::shared_ptr<handler> h = std::make_shared<handler>();
+  h->socket = server;
+  h->server = server;
+  h->on_accept = on_accept;
+  return attach(h);
+}
+
+bool ztd::event_loop::add(socket_abstract* socket, event_callback on_read, event_callback on_write, event_callback on_close)
+{
+  if(!socket->operational())
+    return false;
+  std::shared_ptr<handler> h = std::make_shared<handler>();
+  h->socket = socket;
+  h->on_read = on_read;
+  h->on_write = on_write;
+  h->on_close = on_close;
+  return attach(h);
+}
+
+bool ztd::event_loop::remove(socket_abstract* socket)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  auto it = m_handlers.find(socket->fd());
+  if(it == m_handlers.end() || it->second->socket != socket)
+    return false;
+  epoll_ctl(m_epfd, EPOLL_CTL_DEL, socket->fd(), NULL);
+  m_handlers.erase(it);
+  socket->m_loop = nullptr;
+  return true;
+}
+
+bool ztd::event_loop::watch_write(socket_abstract* socket, bool enable)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  auto it = m_handlers.find(socket->fd());
+  if(it == m_handlers.end() || it->second->socket != socket)
+    return false;
+  handler* h = it->second.get();
+  h->write = enable;
+  // a socket being dispatched is re-armed once its callbacks return
+  if(h->busy || h->paused)
+    return true;
+  return arm(socket->fd(), h, EPOLL_CTL_MOD);
+}
+
+bool ztd::event_loop::rearm(socket_abstract* socket)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  auto it = m_handlers.find(socket->fd());
+  if(it == m_handlers.end() || it->second->socket != socket)
+    return false;
+  if(it->second->busy || it->second->paused)
+    return true;
+  return arm(socket->fd(), it->second.get(), EPOLL_CTL_MOD);
+}
+
+void ztd::event_loop::resume()
+{
+  uint64_t val;
+  if(read(m_timerfd, &val, sizeof(val)) != sizeof(val))
+    return;
+  std::lock_guard<std::mutex> lck(m_mtx);
+  for(auto& it: m_handlers)
+  {
+    if(!it.second->paused)
+      continue;
+    it.second->paused = false;
+    arm(it.first, it.second.get(), EPOLL_CTL_MOD);
+  }
+}
+
+void ztd::event_loop::dispatch(int fd, uint32_t events)
+{
+  std::shared_ptr<handler> h;
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    auto it = m_handlers.find(fd);
+    if(it == m_handlers.end())
+      return;
+    h = it->second;
+    h->busy = true;
+  }
+
+  socket_abstract* s = h->socket;
+  bool closing = false;
+  bool backoff = false;
+  if(h->server != nullptr)
+  {
+    while(true)
+    {
+      tcpsocket_server_instance* inst = new tcpsocket_server_instance(h->server);
+      if(!inst->accept_connection(true))
+      {
+        int err = errno;
+        delete inst;
+        if(err == EINTR || err == ECONNABORTED)
+          continue;
+        // out of descriptors or memory: the connection stays pending, retry after a delay
+        backoff = err == EMFILE || err == ENFILE || err == ENOBUFS || err == ENOMEM;
+        break;
+      }
+      h->on_accept(inst);
+    }
+  }
+  else
+  {
+    if( (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && h->on_read)
+      h->on_read(s);
+    if( (events & EPOLLOUT) && h->on_write && s->operational())
+      h->on_write(s);
+    // sends queued by the callbacks go out together
+    if(s->operational() && s->queued() > 0)
+      s->flush();
+    closing = !s->operational() || (events & (EPOLLHUP | EPOLLERR)) || ( (events & EPOLLRDHUP) && !h->on_read);
+  }
+
+  {
+    std::lock_guard<std::mutex> lck(m_mtx);
+    h->busy = false;
+    auto it = m_handlers.find(fd);
+    if(it != m_handlers.end() && it->second == h)
+    {
+      if(closing)
+      {
+        epoll_ctl(m_epfd, EPOLL_CTL_DEL, fd, NULL);
+        m_handlers.erase(it);
+        s->m_loop = nullptr;
+      }
+      else if(backoff)
+      {
+        h->paused = true;
+        struct itimerspec ts = { { 0, 0 }, { ACCEPT_BACKOFF_MS / 1000, (ACCEPT_BACKOFF_MS % 1000) * 1000000 } };
+        timerfd_settime(m_timerfd, 0, &ts, NULL);
+      }
+      else
+        arm(fd, h.get(), EPOLL_CTL_MOD);
+    }
+  }
+  if(closing && h->on_close)
+    h->on_close(s);
+}
+
+int ztd::event_loop::run_once(int timeout)
+{
+  if(m_epfd < 0)
+    return -1;
+  struct epoll_event events[64];
+  int n = epoll_wait(m_epfd, events, 64, timeout);
+  if(n < 0)
+    return errno == EINTR ? 0 : -1;
+  int ret=0;
+  for(int i=0; i<n; i++)
+  {
+    if(events[i].data.fd == m_evfd)
+      continue;
+    if(events[i].data.fd == m_timerfd)
+    {
+      resume();
+      continue;
+    }
+    dispatch(events[i].data.fd, events[i].events);
+    ret++;
+  }
+  return ret;
+}
+
+void ztd::event_loop::run(unsigned int threads)
+{
+  std::vector<std::thread> workers;
+  for(unsigned int i=1; i<threads; i++)
+  {
+    workers.push_back(std::thread([this] {
+      while(!m_stop && run_once(-1) >= 0);
+    }));
+  }
+  while(!m_stop && run_once(-1) >= 0);
+  for(auto& it: workers)
+    it.join();
+  // reset the stop event so the loop can be run again
+  uint64_t val;
+  if(read(m_evfd, &val, sizeof(val)) < 0) {}
+  m_stop=false;
+}
+
+void ztd::event_loop::stop()
+{
+  m_stop=true;
+  uint64_t val=1;
+  if(write(m_evfd, &val, sizeof(val)) < 0) {}
+}
+
+// io_uring is driven through raw syscalls and ring mappings, liburing is not required
+
+enum _io_op {
+  _io_accept=1,
+  _io_recv,
+  _io_send,
+  _io_shutdown,
+  _io_close,
+  _io_wake,
+  _io_backoff
+};
+
+struct ztd::io_engine::conn
+{
+  socket_abstract* socket=nullptr;
+  tcpsocket_server* server=nullptr;
+  accept_callback on_accept;
+  data_callback on_data;
+  event_callback on_close;
+  // operations in flight
+  unsigned int pending=0;
+  bool receiving=false;
+  bool closing=false;
+  bool shut=false;
+  bool closed=false;
+  // front buffer is in flight
+  std::deque<std::vector<uint8_t>> queue;
+  size_t sent=0;
+};
+
+#ifdef ZTD_IO_URING
+
+struct ztd::io_engine::ring
+{
+  int fd=-1;
+  unsigned int entries=0;
+  void* sq_ptr=MAP_FAILED;
+  size_t sq_size=0;
+  void* cq_ptr=MAP_FAILED;
+  size_t cq_size=0;
+  struct io_uring_sqe* sqes=(struct io_uring_sqe*) MAP_FAILED;
+  size_t sqes_size=0;
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe* cqes;
+  unsigned int to_submit=0;
+  // provided receive buffers
+  uint8_t* bufs=nullptr;
+  uint32_t nbufs=0;
+  uint32_t bufsize=0;
+};
+
+static int _uring_enter(ztd::io_engine::ring* r, unsigned int min_complete, int timeout)
+{
+  unsigned int flags=0;
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  void* argp=NULL;
+  size_t argsz=0;
+  if(min_complete > 0)
+  {
+    flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if(timeout >= 0)
+    {
+      ts.tv_sec = timeout / 1000;
+      ts.tv_nsec = (timeout % 1000) * 1000000L;
+      arg.ts = (uint64_t) &ts;
+    }
+    argp=&arg;
+    argsz=sizeof(arg);
+  }
+  int ret = syscall(__NR_io_uring_enter, r->fd, r->to_submit, min_complete, flags, argp, argsz);
+  if(ret >= 0)
+    r->to_submit -= ret < (int) r->to_submit ? ret : r->to_submit;
+  return ret < 0 ? -errno : ret;
+}
+
+static struct io_uring_sqe* _uring_sqe(ztd::io_engine::ring* r)
+{
+  unsigned int tail = *r->sq_tail;
+  // queue full: submit what is there
+  if(tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->entries)
+    _uring_enter(r, 0, 0);
+  unsigned int idx = tail & *r->sq_mask;
+  struct io_uring_sqe* sqe = &r->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  r->sq_array[idx] = idx;
+  __atomic_store_n(r->sq_tail, tail+1, __ATOMIC_RELEASE);
+  r->to_submit++;
+  return sqe;
+}
+
+// hand receive buffers [bid, bid+count) back to the kernel, completes silently
+static void _uring_give_buffers(ztd::io_engine::ring* r, uint16_t bid, uint32_t count)
+{
+  struct io_uring_sqe* sqe = _uring_sqe(r);
+  sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+  sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+  sqe->fd = count;
+  sqe->addr = (uint64_t) (r->bufs + (size_t) bid*r->bufsize);
+  sqe->len = r->bufsize;
+  sqe->off = bid;
+  sqe->buf_group = 0;
+  sqe->user_data = 0;
+}
+
+static bool _kernel_at_least(int major, int minor)
+{
+  struct utsname u;
+  int ma=0, mi=0;
+  if(uname(&u) != 0 || sscanf(u.release, "%d.%d", &ma, &mi) != 2)
+    return false;
+  return ma > major || (ma == major && mi >= minor);
+}
+
+static inline uint64_t _io_data(void* ptr, _io_op op)
+{
+  return (uint64_t) ptr | op;
+}
+
+#else
+
+struct ztd::io_engine::ring {};
+
+#endif
+
+ztd::io_engine::io_engine(unsigned int entries, uint32_t bufferCount, uint32_t bufferSize)
+{
+  m_uring=nullptr;
+  m_stop=false;
+  m_evfd=-1;
+  if(!uring_init(entries, bufferCount, bufferSize))
+  {
+    uring_free();
+    m_fallback = std::make_unique<event_loop>();
+    m_buffer.resize(bufferSize);
+  }
+}
+
+ztd::io_engine::~io_engine()
+{
+  uring_free();
+  for(auto& it: m_conns)
+    delete it.second;
+}
+
+bool ztd::io_engine::valid()
+{
+  if(m_fallback != nullptr)
+    return m_fallback->valid();
+  return m_uring != nullptr;
+}
+
+bool ztd::io_engine::uring_init(unsigned int entries, uint32_t bufferCount, uint32_t bufferSize)
+{
+#ifdef ZTD_IO_URING
+  // multishot receive needs 6.0
+  if(!_kernel_at_least(6, 0) || bufferSize == 0 || bufferCount == 0 || bufferCount > 65536)
+    return false;
+
+  m_uring = new ring;
+  ring* r = m_uring;
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  r->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if(r->fd < 0)
+    return false;
+  if( !(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG) )
+    return false;
+  r->entries = p.sq_entries;
+
+  r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if(r->cq_size > r->sq_size)
+    r->sq_size = r->cq_size;
+  r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if(r->sq_ptr == MAP_FAILED)
+    return false;
+  uint8_t* sq = (uint8_t*) r->sq_ptr;
+  r->sq_head = (unsigned*) (sq + p.sq_off.head);
+  r->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+  r->sq_mask = (unsigned*) (sq + p.sq_off.ring_mask);
+  r->sq_array = (unsigned*) (sq + p.sq_off.array);
+  r->cq_head = (unsigned*) (sq + p.cq_off.head);
+  r->cq_tail = (unsigned*) (sq + p.cq_off.tail);
+  r->cq_mask = (unsigned*) (sq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe*) (sq + p.cq_off.cqes);
+
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = (struct io_uring_sqe*) mmap(NULL, r->sqes_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if(r->sqes == MAP_FAILED)
+    return false;
+
+  r->nbufs = bufferCount;
+  r->bufsize = bufferSize;
+  r->bufs = (uint8_t*) malloc((size_t) bufferCount * bufferSize);
+  if(r->bufs == nullptr)
+    return false;
+  _uring_give_buffers(r, 0, bufferCount);
+
+  m_evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if(m_evfd < 0)
+    return false;
+  submit_wake();
+  return true;
+#else
+  return false;
+#endif
+}
+
+void ztd::io_engine::uring_free()
+{
+#ifdef ZTD_IO_URING
+  if(m_uring == nullptr)
+    return;
+  ring* r = m_uring;
+  if(r->fd >= 0)
+    ::close(r->fd);
+  if(r->sq_ptr != MAP_FAILED)
+    munmap(r->sq_ptr, r->sq_size);
+  if(r->sqes != MAP_FAILED)
+    munmap(r->sqes, r->sqes_size);
+  free(r->bufs);
+  delete r;
+  m_uring=nullptr;
+#endif
+  if(m_evfd >= 0)
+    ::close(m_evfd);
+  m_evfd=-1;
+}
+
+void ztd::io_engine::submit_wake()
+{
+#ifdef ZTD_IO_URING
+  struct io_uring_sqe* sqe = _uring_sqe(m_uring);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = m_evfd;
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = _io_wake;
+#endif
+}
+
+void ztd::io_engine::submit_accept(conn* c)
+{
+#ifdef ZTD_IO_URING
+  struct io_uring_sqe* sqe = _uring_sqe(m_uring);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = c->server->fd();
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+  sqe->user_data = _io_data(c, _io_accept);
+  c->pending++;
+#endif
+}
+
+// resubmit the accept after a delay, once the timeout completes
+void ztd::io_engine::submit_backoff(conn* c)
+{
+#ifdef ZTD_IO_URING
+  // read by the kernel on submission
+  static const struct __kernel_timespec ts = { ACCEPT_BACKOFF_MS / 1000, (ACCEPT_BACKOFF_MS % 1000) * 1000000 };
+  struct io_uring_sqe* sqe = _uring_sqe(m_uring);
+  sqe->opcode = IORING_OP_TIMEOUT;
+  sqe->fd = -1;
+  sqe->addr = (uint64_t) &ts;
+  sqe->len = 1;
+  sqe->user_data = _io_data(c, _io_backoff);
+  c->pending++;
+#endif
+}
+
+void ztd::io_engine::submit_recv(conn* c)
+{
+#ifdef ZTD_IO_URING
+  struct io_uring_sqe* sqe = _uring_sqe(m_uring);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = c->socket->fd();
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->user_data = _io_data(c, _io_recv);
+  c->pending++;
+  c->receiving=true;
+#endif
+}
+
+void ztd::io_engine::submit_send(conn* c)
+{
+#ifdef ZTD_IO_URING
+  std::vector<uint8_t>& front = c->queue.front();
+  struct io_uring_sqe* sqe = _uring_sqe(m_uring);
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = c->socket->fd();
+  sqe->addr = (uint64_t) (front.data() + c->sent);
+  sqe->len = front.size() - c->sent;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = _io_data(c, _io_send);
+  c->pending++;
+#endif
+}
+
+void ztd::io_engine::begin_close(conn* c)
+{
+  c->closing=true;
+  finish(c);
+}
+
+// advance a closing connection: shutdown once sends are done, close once nothing is in flight
+void ztd::io_engine::finish(conn* c)
+{
+#ifdef ZTD_IO_URING
+  if(!c->closing || c->closed)
+    return;
+  if(!c->shut && c->queue.empty())
+  {
+    // ends the multishot receive
+    struct io_uring_sqe* sqe = _uring_sqe(m_uring);
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = c->socket->fd();
+    sqe->len = SHUT_RDWR;
+    sqe->user_data = _io_data(c, _io_shutdown);
+    c->pending++;
+    c->shut=true;
+  }
+  if(c->pending == 0)
+  {
+    struct io_uring_sqe* sqe = _uring_sqe(m_uring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = c->socket->fd();
+    sqe->user_data = _io_data(c, _io_close);
+    c->pending++;
+    c->closed=true;
+  }
+#endif
+}
+
+bool ztd::io_engine::add_server(tcpsocket_server* server, accept_callback on_accept)
+{
+  if(m_fallback != nullptr)
+    return m_fallback->add_server(server, on_accept);
+  if(!server->is_open() || !on_accept || m_conns.find(server) != m_conns.end())
+    return false;
+  conn* c = new conn;
+  c->socket = server;
+  c->server = server;
+  c->on_accept = on_accept;
+  m_conns[server] = c;
+  submit_accept(c);
+  return true;
+}
+
+bool ztd::io_engine::add(socket_abstract* socket, data_callback on_data, event_callback on_close)
+{
+  if(m_fallback != nullptr)
+  {
+    return m_fallback->add(socket, [this, on_data](socket_abstract* s) {
+      uint32_t size;
+      while(size=m_buffer.size(), s->read_data(m_buffer.data(), &size))
+      {
+        if(on_data)
+          on_data(s, m_buffer.data(), size);
+      }
+    }, nullptr, on_close);
+  }
+  if(!socket->operational() || m_conns.find(socket) != m_conns.end())
+    return false;
+  conn* c = new conn;
+  c->socket = socket;
+  c->on_data = on_data;
+  c->on_close = on_close;
+  m_conns[socket] = c;
+  submit_recv(c);
+  return true;
+}
+
+bool ztd::io_engine::send(socket_abstract* socket, uint8_t const* data, uint32_t size)
+{
+  if(m_fallback != nullptr)
+    return socket->send_data((uint8_t*) data, size);
+  auto it = m_conns.find(socket);
+  if(it == m_conns.end() || it->second->closing || it->second->server != nullptr)
+    return false;
+  conn* c = it->second;
+  if(size == 0)
+    return true;
+  c->queue.push_back(std::vector<uint8_t>(data, data+size));
+  if(c->queue.size() == 1)
+    submit_send(c);
+  return true;
+}
+
+bool ztd::io_engine::close(socket_abstract* socket)
+{
+  if(m_fallback != nullptr)
+  {
+    // the loop sees the hangup and calls the close callback
+    return socket->fd() >= 0 && shutdown(socket->fd(), SHUT_RDWR) == 0;
+  }
+  auto it = m_conns.find(socket);
+  if(it == m_conns.end() || it->second->server != nullptr)
+    return false;
+  if(!it->second->closing)
+    begin_close(it->second);
+  return true;
+}
+
+void ztd::io_engine::complete(uint64_t data, int32_t res, uint32_t flags)
+{
+#ifdef ZTD_IO_URING
+  _io_op op = (_io_op) (data & 7);
+  conn* c = (conn*) (data & ~ (uint64_t) 7);
+  // failed buffer provision
+  if(data == 0)
+    return;
+  if(op == _io_wake)
+  {
+    uint64_t val;
+    if(read(m_evfd, &val, sizeof(val)) < 0) {}
+    submit_wake();
+    return;
+  }
+  if( !(flags & IORING_CQE_F_MORE) )
+    c->pending--;
+
+  switch(op)
+  {
+    case _io_accept:
+      if(res >= 0)
+      {
+        tcpsocket_server_instance* inst = new tcpsocket_server_instance(c->server);
+        inst->m_fd = res;
+        inst->m_operational = true;
+        inst->m_clilen = sizeof(inst->m_cliaddr);
+        getpeername(res, (struct sockaddr*) &inst->m_cliaddr, &inst->m_clilen);
+        c->on_accept(inst);
+      }
+      if( !(flags & IORING_CQE_F_MORE) && res != -EBADF && res != -EINVAL)
+      {
+        // out of descriptors or memory: accepting again would fail at once
+        if(res == -EMFILE || res == -ENFILE || res == -ENOBUFS || res == -ENOMEM)
+          submit_backoff(c);
+        else
+          submit_accept(c);
+      }
+      break;
+    case _io_backoff:
+      submit_accept(c);
+      break;
+    case _io_recv:
+      if(flags & IORING_CQE_F_BUFFER)
+      {
+        uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if(res > 0 && c->on_data)
+          c->on_data(c->socket, m_uring->bufs + (size_t) bid*m_uring->bufsize, res);
+        _uring_give_buffers(m_uring, bid, 1);
+      }
+      if( !(flags & IORING_CQE_F_MORE) )
+      {
+        c->receiving=false;
+        // out of buffers or the multishot ended on its own: receive again
+        if(!c->closing && (res > 0 || res == -ENOBUFS))
+          submit_recv(c);
+        else
+          c->closing=true;
+      }
+      break;
+    case _io_send:
+      if(res < 0)
+      {
+        c->queue.clear();
+        c->closing=true;
+        break;
+      }
+      c->sent += res;
+      if(c->sent >= c->queue.front().size())
+      {
+        c->queue.pop_front();
+        c->sent=0;
+      }
+      if(!c->queue.empty())
+        submit_send(c);
+      break;
+    case _io_shutdown:
+      break;
+    case _io_close:
+    {
+      socket_abstract* s = c->socket;
+      event_callback cb = c->on_close;
+      s->m_fd=-1;
+      s->m_operational=false;
+      m_conns.erase(s);
+      delete c;
+      if(cb)
+        cb(s);
+      return;
+    }
+    default: break;
+  }
+  finish(c);
+#endif
+}
+
+int ztd::io_engine::run_once(int timeout)
+{
+  if(m_fallback != nullptr)
+    return m_fallback->run_once(timeout);
+#ifdef ZTD_IO_URING
+  ring* r = m_uring;
+  int ret;
+  if(__atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE) == *r->cq_head)
+    ret = _uring_enter(r, 1, timeout);
+  else
+    ret = r->to_submit > 0 ? _uring_enter(r, 0, 0) : 0;
+  if(ret < 0 && ret != -ETIME && ret != -EINTR)
+    return -1;
+
+  int n=0;
+  unsigned int head = *r->cq_head;
+  while(head != __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE))
+  {
+    struct io_uring_cqe cqe = r->cqes[head & *r->cq_mask];
+    head++;
+    __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+    complete(cqe.user_data, cqe.res, cqe.flags);
+    n++;
+  }
+  return n;
+#else
+  return -1;
+#endif
+}
+
+void ztd::io_engine::run()
+{
+  if(m_fallback != nullptr)
+  {
+    m_fallback->run();
+    return;
+  }
+  while(!m_stop && run_once(-1) >= 0);
+  m_stop=false;
+}
+
+void ztd::io_engine::stop()
+{
+  if(m_fallback != nullptr)
+  {
+    m_fallback->stop();
+    return;
+  }
+  m_stop=true;
+  uint64_t val=1;
+  if(write(m_evfd, &val, sizeof(val)) < 0) {}
+}
+
+ztd::message_framer::message_framer(modeEnum mode, size_t maxSize, uint8_t delim)
+{
+  m_mode=mode;
+  m_maxSize=maxSize;
+  m_delim=delim;
+  m_error=false;
+  m_start=0;
+  m_end=0;
+  m_scan=0;
+}
+
+size_t ztd::message_framer::encode_varint(uint64_t size, uint8_t* out)
+{
+  size_t n=0;
+  while(size >= 0x80)
+  {
+    out[n++] = (size & 0x7f) | 0x80;
+    size >>= 7;
+  }
+  out[n++] = size;
+  return n;
+}
+
+std::span<uint8_t> ztd::message_framer::prepare(size_t size)
+{
+  if(m_buffer.size() - m_end < size)
+  {
+    // move undelivered data to the front before growing
+    if(m_start > 0)
+    {
+      memmove(m_buffer.data(), m_buffer.data()+m_start, m_end-m_start);
+      m_end -= m_start;
+      m_scan -= m_start;
+      m_start = 0;
+    }
+    if(m_buffer.size() - m_end < size)
+      m_buffer.resize(std::max(m_end + size, m_buffer.size()*2));
+  }
+  return std::span<uint8_t>(m_buffer.data()+m_end, m_buffer.size()-m_end);
+}
+
+void ztd::message_framer::commit(size_t n)
+{
+  m_end += n;
+}
+
+void ztd::message_framer::feed(uint8_t const* data, size_t size)
+{
+  std::span<uint8_t> space = prepare(size);
+  memcpy(space.data(), data, size);
+  commit(size);
+}
+
+bool ztd::message_framer::next(std::span<const uint8_t>& message)
+{
+  if(m_error)
+    return false;
+  if(m_start == m_end)
+  {
+    // nothing buffered: reuse the buffer from its start
+    m_start = m_end = m_scan = 0;
+    return false;
+  }
+  uint8_t const* data = m_buffer.data();
+  if(m_mode == varint)
+  {
+    uint64_t size=0;
+    size_t i=m_start;
+    for(unsigned int shift=0; ; shift+=7)
+    {
+      if(i >= m_end)
+        return false;
+      if(shift > 63)
+      {
+        m_error=true;
+        return false;
+      }
+      uint8_t c = data[i++];
+      // only the lowest bit of the tenth byte fits in 64 bits
+      if(shift == 63 && (c & 0x7e))
+      {
+        m_error=true;
+        return false;
+      }
+      size |= (uint64_t) (c & 0x7f) << shift;
+      if( !(c & 0x80) )
+        break;
+    }
+    if(size > m_maxSize)
+    {
+      m_error=true;
+      return false;
+    }
+    if(m_end - i < size)
+      return false;
+    message = std::span<const uint8_t>(data+i, size);
+    m_start = m_scan = i+size;
+    return true;
+  }
+  else
+  {
+    m_scan = std::max(m_scan, m_start);
+    uint8_t const* pos = (uint8_t const*) memchr(data+m_scan, m_delim, m_end-m_scan);
+    if(pos == NULL)
+    {
+      m_scan = m_end;
+      if(m_end - m_start > m_maxSize)
+        m_error=true;
+      return false;
+    }
+    size_t size = pos - (data+m_start);
+    if(size > m_maxSize)
+    {
+      m_error=true;
+      return false;
+    }
+    message = std::span<const uint8_t>(data+m_start, size);
+    m_start = m_scan = m_start+size+1;
+    return true;
+  }
+}
+
+void ztd::message_framer::reset()
+{
+  m_error=false;
+  m_start=0;
+  m_end=0;
+  m_scan=0;
+}
+
+ztd::pool_buffer::pool_buffer(pool_buffer&& other) noexcept
+{
+  m_block=other.m_block;
+  other.m_block=nullptr;
+}
+
+ztd::pool_buffer& ztd::pool_buffer::operator=(pool_buffer&& other) noexcept
+{
+  if(this != &other)
+  {
+    reset();
+    m_block=other.m_block;
+    other.m_block=nullptr;
+  }
+  return *this;
+}
+
+ztd::pool_buffer::~pool_buffer()
+{
+  reset();
+}
+
+size_t ztd::pool_buffer::capacity() const
+{
+  return m_block->pool->buffer_size();
+}
+
+ztd::pool_buffer ztd::pool_buffer::share() const
+{
+  if(m_block == nullptr)
+    return pool_buffer();
+  m_block->refs.fetch_add(1, std::memory_order_relaxed);
+  return pool_buffer(m_block);
+}
+
+void ztd::pool_buffer::reset()
+{
+  if(m_block != nullptr && m_block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    m_block->pool->release(m_block);
+  m_block=nullptr;
+}
+
+ztd::buffer_pool::buffer_pool(uint32_t bufferSize, uint32_t slabCount)
+{
+  m_bufferSize=bufferSize;
+  m_slabCount= slabCount > 0 ? slabCount : 1;
+  m_free=nullptr;
+  m_available=0;
+}
+
+ztd::buffer_pool::~buffer_pool()
+{
+}
+
+ztd::pool_buffer ztd::buffer_pool::acquire()
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  if(m_free == nullptr)
+  {
+    // new slab
+    pool_buffer::block* blocks = new pool_buffer::block[m_slabCount];
+    uint8_t* data = new uint8_t[(size_t) m_slabCount * m_bufferSize];
+    m_blocks.push_back(std::unique_ptr<pool_buffer::block[]>(blocks));
+    m_slabs.push_back(std::unique_ptr<uint8_t[]>(data));
+    for(uint32_t i=0; i<m_slabCount; i++)
+    {
+      blocks[i].data = data + (size_t) i*m_bufferSize;
+      blocks[i].pool = this;
+      blocks[i].next = m_free;
+      m_free = &blocks[i];
+    }
+    m_available += m_slabCount;
+  }
+  pool_buffer::block* b = m_free;
+  m_free = b->next;
+  m_available--;
+  b->refs.store(1, std::memory_order_relaxed);
+  b->size = 0;
+  b->next = nullptr;
+  return pool_buffer(b);
+}
+
+void ztd::buffer_pool::release(pool_buffer::block* b)
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  b->next = m_free;
+  m_free = b;
+  m_available++;
+}
+
+size_t ztd::buffer_pool::allocated()
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_blocks.size() * m_slabCount;
+}
+
+size_t ztd::buffer_pool::available()
+{
+  std::lock_guard<std::mutex> lck(m_mtx);
+  return m_available;
+}